@@ -0,0 +1,62 @@
+#!/bin/sh
+#
+# ZX5 benchmark: compresses every file in the corpus using each mode, then
+# decompresses the results, and writes a JSON array of measurements.
+# Decompression time is measured by decoding each file DECODE_REPEAT times
+# within a single batch process, so process startup does not dominate it.
+#
+# Usage: bench.sh zx5 dzx5 runstat corpus_dir work_dir
+#
+
+ZX5=$1
+DZX5=$2
+RUNSTAT=$3
+CORPUS=$4
+WORK=$5
+DECODE_REPEAT=${DECODE_REPEAT:-1000}
+
+mkdir -p "$WORK" || exit 1
+
+calc() {
+    awk -v a="$2" -v b="$3" "BEGIN { printf \"$1\", a/b }"
+}
+
+separator=" "
+echo "["
+for input in "$CORPUS"/*; do
+    name=`basename "$input"`
+    input_size=`wc -c < "$input"`
+    for mode in full quick backwards; do
+        case $mode in
+            full)      options="" ;;
+            quick)     options="-q" ;;
+            backwards) options="-b" ;;
+        esac
+        output="$WORK/$name.$mode.zx5"
+        set -- `"$RUNSTAT" 1 "$ZX5" -f $options "$input" "$output"` || exit 1
+        time=$1
+        rss=$2
+        output_size=`wc -c < "$output"`
+        echo "$separator{\"file\": \"$name\", \"tool\": \"zx5\", \"mode\": \"$mode\", \"input_size\": $input_size, \"output_size\": $output_size, \"ratio\": `calc %.4f $output_size $input_size`, \"time\": $time, \"max_rss_kb\": $rss}"
+        separator=","
+
+        # the C decompressor does not support backwards files
+        if [ $mode != backwards ]; then
+            set -- `"$RUNSTAT" 1 "$DZX5" -f "$output" "$WORK/$name.$mode.out"` || exit 1
+            rss=$2
+            if ! cmp -s "$input" "$WORK/$name.$mode.out"; then
+                echo "Error: Decompressed $name.$mode differs from original" >&2
+                exit 1
+            fi
+            batch=`awk -v name="$output" -v n=$DECODE_REPEAT 'BEGIN { for (i = 0; i < n; i++) printf "%s ", name }'`
+            time=`"$DZX5" -f -j1 --batch $batch | sed -n 's/.* in \([0-9.]*\) seconds.*/\1/p'`
+            if [ -z "$time" ]; then
+                echo "Error: Cannot measure decompression of $name.$mode" >&2
+                exit 1
+            fi
+            time=`calc %.6f $time $DECODE_REPEAT`
+            echo "$separator{\"file\": \"$name\", \"tool\": \"dzx5\", \"mode\": \"$mode\", \"input_size\": $output_size, \"output_size\": $input_size, \"time\": $time, \"max_rss_kb\": $rss, \"mb_per_s\": `calc %.3f \`calc %.6f $input_size 1000000\` $time`}"
+        fi
+    done
+done
+echo "]"
@@ -0,0 +1,32 @@
+#!/bin/sh
+#
+# Compares two JSON results written by bench.sh, one record per line.
+#
+# Usage: compare.sh baseline.json results.json
+#
+
+awk '
+function field(line, key,    pattern) {
+    pattern = "\"" key "\": \"?[^,}\"]*"
+    if (!match(line, pattern))
+        return ""
+    line = substr(line, RSTART+length(key)+4, RLENGTH-length(key)-4)
+    sub(/^"/, "", line)
+    return line
+}
+function ratio(new, old) {
+    return old > 0 ? sprintf("%7.3f", new/old) : "      -"
+}
+/"file"/ {
+    key = field($0, "file") " " field($0, "tool") " " field($0, "mode")
+    if (FILENAME == ARGV[1]) {
+        time[key] = field($0, "time")
+        rss[key] = field($0, "max_rss_kb")
+        size[key] = field($0, "output_size")
+    } else if (key in time) {
+        if (!header++)
+            printf "%-40s %7s %7s %7s\n", "benchmark", "time", "rss", "size"
+        printf "%-40s %s %s %s\n", key, ratio(field($0, "time"), time[key]), ratio(field($0, "max_rss_kb"), rss[key]), ratio(field($0, "output_size"), size[key])
+    }
+}
+' "$1" "$2"
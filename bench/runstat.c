@@ -0,0 +1,82 @@
+/*
+ * (c) Copyright 2021 by Einar Saukas. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * The name of its author may not be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Benchmark helper: runs a command a number of times, then reports total
+ * wall time in seconds and peak resident set size in KB.
+ *
+ * Usage: runstat repeat command [args...]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+int main(int argc, char *argv[]) {
+    struct timeval start;
+    struct timeval end;
+    struct rusage usage;
+    long max_rss = 0;
+    int repeat;
+    int status;
+    int null;
+    pid_t pid;
+    int i;
+
+    if (argc < 3 || (repeat = atoi(argv[1])) <= 0) {
+        fprintf(stderr, "Usage: %s repeat command [args...]\n", argv[0]);
+        exit(1);
+    }
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < repeat; i++) {
+        pid = fork();
+        if (pid < 0) {
+            fprintf(stderr, "Error: Cannot execute %s\n", argv[2]);
+            exit(1);
+        }
+        if (!pid) {
+            null = open("/dev/null", O_WRONLY);
+            dup2(null, STDOUT_FILENO);
+            execvp(argv[2], argv+2);
+            _exit(127);
+        }
+        if (wait4(pid, &status, 0, &usage) < 0 || !WIFEXITED(status) || WEXITSTATUS(status)) {
+            fprintf(stderr, "Error: Command %s failed\n", argv[2]);
+            exit(1);
+        }
+        if (max_rss < usage.ru_maxrss)
+            max_rss = usage.ru_maxrss;
+    }
+    gettimeofday(&end, NULL);
+
+    printf("%.6f %ld\n", (end.tv_sec-start.tv_sec)+(end.tv_usec-start.tv_usec)/1e6, max_rss);
+
+    return 0;
+}
@@ -25,8 +25,10 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <assert.h>
 
 #include "zx5.h"
+#include "trace.h"
 
 unsigned char* output_data;
 int output_index;
@@ -36,6 +38,16 @@ int bit_mask;
 int diff;
 int skip_next;
 
+/* bits written so far, excluding unused bits of last group */
+long written_bits() {
+    long bits = output_index*8L;
+    int mask;
+
+    for (mask = bit_mask; mask; mask >>= 1)
+        bits--;
+    return bits;
+}
+
 void read_bytes(int n, int *delta) {
     input_index += n;
     diff += n;
@@ -63,34 +75,40 @@ void write_bit(int value) {
     }
 }
 
-void write_interlaced_elias_gamma(int value, int backwards_mode, int invert_mode) {
-    int i;
-
-    for (i = 2; i <= value; i <<= 1)
-        ;
-    i >>= 1;
-    while (i >>= 1) {
-        write_bit(backwards_mode);
-        write_bit(invert_mode ? !(value & i) : (value & i));
-    }
-    write_bit(!backwards_mode);
-}
+#define KERNEL(name) name##_forward_classic
+#define BACKWARDS_MODE FALSE
+#define INVERT_MODE FALSE
+#include "compress_kernel.h"
+#undef KERNEL
+#undef BACKWARDS_MODE
+#undef INVERT_MODE
+
+#define KERNEL(name) name##_forward
+#define BACKWARDS_MODE FALSE
+#define INVERT_MODE TRUE
+#include "compress_kernel.h"
+#undef KERNEL
+#undef BACKWARDS_MODE
+#undef INVERT_MODE
+
+#define KERNEL(name) name##_backward
+#define BACKWARDS_MODE TRUE
+#define INVERT_MODE FALSE
+#include "compress_kernel.h"
+#undef KERNEL
+#undef BACKWARDS_MODE
+#undef INVERT_MODE
+
+/* forward without and with inverted offset MSB, then backwards (never inverted) */
+void (*compress_kernels[3])(BLOCK *optimal, unsigned char *input_data, int *delta) = {
+    compress_forward_classic, compress_forward, compress_backward
+};
 
 unsigned char *compress(BLOCK *optimal, unsigned char *input_data, int input_size, int skip, int backwards_mode, int invert_mode, int *output_size, int *delta) {
     BLOCK *prev;
     BLOCK *next;
-    int last_offset1 = INITIAL_OFFSET;
-    int last_offset2 = -1;
-    int last_offset3 = -1;
-    int i;
-
-    /* calculate and allocate output buffer */
-    *output_size = (optimal->bits+27)/8;
-    output_data = (unsigned char *)malloc(*output_size);
-    if (!output_data) {
-         fprintf(stderr, "Error: Insufficient memory\n");
-         exit(1);
-    }
+    long bits;
+    double start = trace_clock();
 
     /* un-reverse optimal sequence */
     prev = NULL;
@@ -101,6 +119,15 @@ unsigned char *compress(BLOCK *optimal, unsigned char *input_data, int input_siz
         optimal = next;
     }
 
+    /* calculate and allocate output buffer, counting bits again since chains joined from segments may exceed an int */
+    bits = chain_bits(prev->chain);
+    *output_size = (int)((bits+27)/8);
+    output_data = (unsigned char *)malloc(*output_size);
+    if (!output_data) {
+         fprintf(stderr, "Error: Insufficient memory\n");
+         exit(1);
+    }
+
     /* initialize data */
     diff = *output_size-input_size+skip;
     *delta = 0;
@@ -110,82 +137,11 @@ unsigned char *compress(BLOCK *optimal, unsigned char *input_data, int input_siz
     skip_next = TRUE;
 
     /* generate output */
-    for (optimal = prev->chain; optimal; optimal = optimal->chain) {
-        if (!optimal->offset) {
-            /* copy literals indicator */
-            write_bit(0);
-
-            /* copy literals length */
-            write_interlaced_elias_gamma(optimal->length, backwards_mode, FALSE);
-
-            /* copy literals values */
-            for (i = 0; i < optimal->length; i++) {
-                write_byte(input_data[input_index]);
-                read_bytes(1, delta);
-            }
-        } else if (optimal->offset == last_offset1) {
-            /* copy from last offset indicator */
-            write_bit(0);
-
-            /* copy from last offset length */
-            write_interlaced_elias_gamma(optimal->length, backwards_mode, FALSE);
-            read_bytes(optimal->length, delta);
-        } else if (optimal->offset == last_offset2) {
-            /* copy from 2nd last offset indicator */
-            write_bit(1);
-            write_bit(0);
-            write_bit(0);
-
-            /* copy from 2nd last offset length */
-            write_interlaced_elias_gamma(optimal->length, backwards_mode, FALSE);
-            read_bytes(optimal->length, delta);
-
-            last_offset2 = last_offset1;
-            last_offset1 = optimal->offset;
-        } else if (optimal->offset == last_offset3) {
-            /* copy from 3rd last offset indicator */
-            write_bit(1);
-            write_bit(0);
-            write_bit(1);
-
-            /* copy from 3rd last offset length */
-            write_interlaced_elias_gamma(optimal->length, backwards_mode, FALSE);
-            read_bytes(optimal->length, delta);
-
-            last_offset3 = last_offset2;
-            last_offset2 = last_offset1;
-            last_offset1 = optimal->offset;
-        } else {
-            /* copy from new offset indicator */
-            write_bit(1);
-            write_bit(1);
-            write_bit((optimal->length > 2) == backwards_mode);
-
-            /* copy from new offset MSB */
-            write_interlaced_elias_gamma((optimal->offset-1)/256+1, backwards_mode, invert_mode);
-
-            /* copy from new offset LSB */
-            if (backwards_mode)
-                write_byte((optimal->offset-1)%256);
-            else
-                write_byte(255-(optimal->offset-1)%256);
-
-            /* copy from new offset length */
-            skip_next = TRUE;
-            write_interlaced_elias_gamma(optimal->length-1, backwards_mode, FALSE);
-            read_bytes(optimal->length, delta);
-
-            last_offset3 = last_offset2;
-            last_offset2 = last_offset1;
-            last_offset1 = optimal->offset;
-        }
-    }
+    compress_kernels[backwards_mode ? 2 : invert_mode ? 1 : 0](prev->chain, input_data, delta);
 
-    /* end marker */
-    write_bit(1);
-    write_bit(1);
-    write_bit(0);
-    write_interlaced_elias_gamma(256, backwards_mode, invert_mode);
+    /* output must match bits counted, plus end marker */
+    assert(written_bits() == bits+20);
+    trace_event("compress", start, "\"bits\":%ld,\"size\":%d,\"delta\":%d", bits, *output_size, *delta);
 
     /* done! */
     return output_data;
@@ -0,0 +1,143 @@
+/*
+ * (c) Copyright 2021 by Einar Saukas. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * The name of its author may not be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Compressor kernel, included once per file format variant with the
+ * following parameters defined:
+ *
+ *   KERNEL(name)    name suffixed with the variant
+ *   BACKWARDS_MODE  TRUE to compress backwards
+ *   INVERT_MODE     TRUE to invert bits of offset MSB
+ */
+
+void KERNEL(write_interlaced_elias_gamma)(int value) {
+    int i;
+
+    for (i = 2; i <= value; i <<= 1)
+        ;
+    i >>= 1;
+    while (i >>= 1) {
+        write_bit(BACKWARDS_MODE);
+        write_bit(value & i);
+    }
+    write_bit(!BACKWARDS_MODE);
+}
+
+void KERNEL(write_offset_msb)(int value) {
+    int i;
+
+    for (i = 2; i <= value; i <<= 1)
+        ;
+    i >>= 1;
+    while (i >>= 1) {
+        write_bit(BACKWARDS_MODE);
+        write_bit(INVERT_MODE ? !(value & i) : (value & i));
+    }
+    write_bit(!BACKWARDS_MODE);
+}
+
+void KERNEL(compress)(BLOCK *optimal, unsigned char *input_data, int *delta) {
+    int last_offset1 = INITIAL_OFFSET;
+    int last_offset2 = -1;
+    int last_offset3 = -1;
+    int i;
+
+    for (; optimal; optimal = optimal->chain) {
+        if (!optimal->offset) {
+            /* copy literals indicator */
+            write_bit(0);
+
+            /* copy literals length */
+            KERNEL(write_interlaced_elias_gamma)(optimal->length);
+
+            /* copy literals values */
+            for (i = 0; i < optimal->length; i++) {
+                write_byte(input_data[input_index]);
+                read_bytes(1, delta);
+            }
+        } else if (optimal->offset == last_offset1) {
+            /* copy from last offset indicator */
+            write_bit(0);
+
+            /* copy from last offset length */
+            KERNEL(write_interlaced_elias_gamma)(optimal->length);
+            read_bytes(optimal->length, delta);
+        } else if (optimal->offset == last_offset2) {
+            /* copy from 2nd last offset indicator */
+            write_bit(1);
+            write_bit(0);
+            write_bit(0);
+
+            /* copy from 2nd last offset length */
+            KERNEL(write_interlaced_elias_gamma)(optimal->length);
+            read_bytes(optimal->length, delta);
+
+            last_offset2 = last_offset1;
+            last_offset1 = optimal->offset;
+        } else if (optimal->offset == last_offset3) {
+            /* copy from 3rd last offset indicator */
+            write_bit(1);
+            write_bit(0);
+            write_bit(1);
+
+            /* copy from 3rd last offset length */
+            KERNEL(write_interlaced_elias_gamma)(optimal->length);
+            read_bytes(optimal->length, delta);
+
+            last_offset3 = last_offset2;
+            last_offset2 = last_offset1;
+            last_offset1 = optimal->offset;
+        } else {
+            /* copy from new offset indicator */
+            write_bit(1);
+            write_bit(1);
+            write_bit((optimal->length > 2) == BACKWARDS_MODE);
+
+            /* copy from new offset MSB */
+            KERNEL(write_offset_msb)((optimal->offset-1)/256+1);
+
+            /* copy from new offset LSB */
+            if (BACKWARDS_MODE)
+                write_byte((optimal->offset-1)%256);
+            else
+                write_byte(255-(optimal->offset-1)%256);
+
+            /* copy from new offset length */
+            skip_next = TRUE;
+            KERNEL(write_interlaced_elias_gamma)(optimal->length-1);
+            read_bytes(optimal->length, delta);
+
+            last_offset3 = last_offset2;
+            last_offset2 = last_offset1;
+            last_offset1 = optimal->offset;
+        }
+    }
+
+    /* end marker */
+    write_bit(1);
+    write_bit(1);
+    write_bit(0);
+    KERNEL(write_offset_msb)(256);
+}
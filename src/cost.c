@@ -0,0 +1,64 @@
+/*
+ * (c) Copyright 2021 by Einar Saukas. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * The name of its author may not be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "zx5.h"
+
+/* bits of Elias gamma code, indexed by value up to elias_limit */
+unsigned char *elias_costs = NULL;
+int elias_limit = 0;
+
+/* bits of new offset indicator, MSB and LSB, indexed by offset */
+unsigned char offset_costs[MAX_OFFSET_ZX5+1];
+
+int elias_gamma_bits(int value) {
+    int bits = 1;
+    while (value >>= 1)
+        bits += 2;
+    return bits;
+}
+
+/* extend cost tables to cover every length within input */
+void prepare_costs(int input_size) {
+    int offset;
+    int value;
+
+    if (input_size <= elias_limit)
+        return;
+    if (!elias_costs)
+        for (offset = 1; offset <= MAX_OFFSET_ZX5; offset++)
+            offset_costs[offset] = 10 + elias_gamma_bits((offset-1)/256+1);
+    elias_costs = (unsigned char *)realloc(elias_costs, input_size+1);
+    if (!elias_costs) {
+         fprintf(stderr, "Error: Insufficient memory\n");
+         exit(1);
+    }
+    elias_costs[0] = 0;
+    for (value = elias_limit+1; value <= input_size; value++)
+        elias_costs[value] = value > 1 ? elias_costs[value/2]+2 : 1;
+    elias_limit = input_size;
+}
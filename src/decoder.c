@@ -0,0 +1,366 @@
+/*
+ * (c) Copyright 2021 by Einar Saukas. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * The name of its author may not be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "zx5.h"
+
+/* decoder features, each line is only generated when all its features are used */
+#define PREVIOUS_OFFSETS 1   /* copies from 2nd or 3rd last offset */
+#define THIRD_OFFSET 2       /* copies from 3rd last offset */
+#define UNROLL_LITERALS 4    /* literals length read inline */
+#define CALL_LITERALS 8      /* literals length read by subroutine */
+#define UNROLL_LAST 16       /* last offset length read inline */
+#define CALL_LAST 32         /* last offset length read by subroutine */
+#define CALL_ELIAS 64        /* any length read by subroutine from start */
+#define LONG_OFFSETS 128     /* new offset MSB read as Elias gamma */
+#define SHORT_OFFSETS 256    /* new offsets up to 256 only, MSB read as single bit */
+
+/* in fast decoders, unroll paths used by at least this fraction of all blocks */
+#define UNROLL_SHARE 4
+
+typedef struct line_t {
+    int features;
+    int size;
+    char *text;
+} LINE;
+
+/* based on "dzx5_standard.asm" */
+LINE forward_decoder[] = {
+    { 0,                 0, "dzx5_custom:" },
+    { 0,                 3, "        ld      bc, $ffff               ; preserve default offset 1" },
+    { 0,                 1, "        push    bc" },
+    { 0,                 1, "        inc     bc" },
+    { 0,                 2, "        ld      a, $80" },
+    { 0,                 0, "dzx5c_literals:" },
+    { CALL_LITERALS,     3, "        call    dzx5c_elias             ; obtain length" },
+    { UNROLL_LITERALS,   1, "        inc     c                       ; obtain length" },
+    { UNROLL_LITERALS,   1, "        add     a, a" },
+    { UNROLL_LITERALS,   2, "        jr      nz, dzx5c_literals_skip" },
+    { UNROLL_LITERALS,   1, "        ld      a, (hl)                 ; load another group of 8 bits" },
+    { UNROLL_LITERALS,   1, "        inc     hl" },
+    { UNROLL_LITERALS,   1, "        rla" },
+    { UNROLL_LITERALS,   0, "dzx5c_literals_skip:" },
+    { UNROLL_LITERALS,   3, "        call    nc, dzx5c_elias_backtrack" },
+    { 0,                 2, "        ldir                            ; copy literals" },
+    { 0,                 1, "        add     a, a                    ; copy from last offset or another offset?" },
+    { 0,                 2, "        jr      c, dzx5c_other_offset" },
+    { 0,                 0, "dzx5c_last_offset:" },
+    { CALL_LAST,         3, "        call    dzx5c_elias             ; obtain length" },
+    { UNROLL_LAST,       1, "        inc     c                       ; obtain length" },
+    { UNROLL_LAST,       1, "        add     a, a" },
+    { UNROLL_LAST,       2, "        jr      nz, dzx5c_last_offset_skip" },
+    { UNROLL_LAST,       1, "        ld      a, (hl)                 ; load another group of 8 bits" },
+    { UNROLL_LAST,       1, "        inc     hl" },
+    { UNROLL_LAST,       1, "        rla" },
+    { UNROLL_LAST,       0, "dzx5c_last_offset_skip:" },
+    { UNROLL_LAST,       3, "        call    nc, dzx5c_elias_backtrack" },
+    { 0,                 0, "dzx5c_copy:" },
+    { 0,                 1, "        ex      (sp), hl                ; preserve source, restore offset" },
+    { 0,                 1, "        push    hl                      ; preserve offset" },
+    { 0,                 1, "        add     hl, de                  ; calculate destination - offset" },
+    { 0,                 2, "        ldir                            ; copy from offset" },
+    { 0,                 1, "        pop     hl                      ; restore offset" },
+    { 0,                 1, "        ex      (sp), hl                ; preserve offset, restore source" },
+    { 0,                 1, "        add     a, a                    ; copy from literals or another offset?" },
+    { 0,                 2, "        jr      nc, dzx5c_literals" },
+    { 0,                 0, "dzx5c_other_offset:" },
+    { 0,                 1, "        add     a, a                    ; copy from previous offset or new offset?" },
+    { 0,                 2, "        jr      nz, dzx5c_other_offset_skip" },
+    { 0,                 1, "        ld      a, (hl)                 ; load another group of 8 bits" },
+    { 0,                 1, "        inc     hl" },
+    { 0,                 1, "        rla" },
+    { 0,                 0, "dzx5c_other_offset_skip:" },
+    { 0,                 1, "        exx" },
+    { PREVIOUS_OFFSETS,  2, "        jr      nc, dzx5c_prev_offset" },
+    { 0,                 0, "dzx5c_new_offset:" },
+    { THIRD_OFFSET,      1, "        ex      de, hl                  ; copy 2nd last offset to 3rd last offset" },
+    { 0,                 1, "        pop     hl                      ; copy last offset to 2nd last offset" },
+    { 0,                 1, "        ld      b, a                    ; preserve next bit" },
+    { 0,                 1, "        add     a, a" },
+    { 0,                 1, "        exx" },
+    { LONG_OFFSETS,      2, "        ld      c, $fe                  ; prepare negative offset" },
+    { LONG_OFFSETS,      3, "        call    dzx5c_elias_loop        ; obtain offset MSB" },
+    { LONG_OFFSETS,      1, "        inc     c" },
+    { LONG_OFFSETS,      1, "        ret     z                       ; check end marker" },
+    { LONG_OFFSETS,      1, "        ld      b, c" },
+    { SHORT_OFFSETS,     1, "        add     a, a                    ; obtain offset MSB" },
+    { SHORT_OFFSETS,     2, "        jr      nz, dzx5c_new_offset_skip" },
+    { SHORT_OFFSETS,     1, "        ld      a, (hl)                 ; load another group of 8 bits" },
+    { SHORT_OFFSETS,     1, "        inc     hl" },
+    { SHORT_OFFSETS,     1, "        rla" },
+    { SHORT_OFFSETS,     0, "dzx5c_new_offset_skip:" },
+    { SHORT_OFFSETS,     1, "        ret     nc                      ; check end marker" },
+    { SHORT_OFFSETS,     1, "        dec     b                       ; offset MSB is always $ff" },
+    { 0,                 1, "        ld      c, (hl)                 ; obtain offset LSB" },
+    { 0,                 1, "        inc     hl" },
+    { 0,                 1, "        push    bc                      ; preserve new offset" },
+    { 0,                 3, "        ld      bc, 1                   ; obtain length" },
+    { 0,                 1, "        exx" },
+    { 0,                 1, "        dec     b                       ; restore preserved bit" },
+    { 0,                 1, "        exx" },
+    { 0,                 3, "        call    p, dzx5c_elias_backtrack" },
+    { 0,                 1, "        inc     bc" },
+    { 0,                 2, "        jr      dzx5c_copy" },
+    { PREVIOUS_OFFSETS,  0, "dzx5c_prev_offset:" },
+    { PREVIOUS_OFFSETS,  1, "        add     a, a                    ; copy from 2nd offset or 3rd offset?" },
+    { THIRD_OFFSET,      2, "        jr      nc, dzx5c_second_offset" },
+    { THIRD_OFFSET,      1, "        ex      de, hl" },
+    { THIRD_OFFSET,      0, "dzx5c_second_offset:" },
+    { PREVIOUS_OFFSETS,  1, "        ex      (sp), hl" },
+    { PREVIOUS_OFFSETS,  1, "        exx" },
+    { PREVIOUS_OFFSETS,  2, "        jr      dzx5c_last_offset" },
+    { CALL_ELIAS,        0, "dzx5c_elias:" },
+    { CALL_ELIAS,        1, "        inc     c                       ; interlaced Elias gamma coding" },
+    { 0,                 0, "dzx5c_elias_loop:" },
+    { 0,                 1, "        add     a, a" },
+    { 0,                 2, "        jr      nz, dzx5c_elias_skip" },
+    { 0,                 1, "        ld      a, (hl)                 ; load another group of 8 bits" },
+    { 0,                 1, "        inc     hl" },
+    { 0,                 1, "        rla" },
+    { 0,                 0, "dzx5c_elias_skip:" },
+    { 0,                 1, "        ret     c" },
+    { 0,                 0, "dzx5c_elias_backtrack:" },
+    { 0,                 1, "        add     a, a" },
+    { 0,                 2, "        rl      c" },
+    { 0,                 2, "        rl      b" },
+    { 0,                 2, "        jr      dzx5c_elias_loop" },
+    { 0,                 0, NULL }
+};
+
+/* based on "dzx5_standard_back.asm" */
+LINE backward_decoder[] = {
+    { 0,                 0, "dzx5_custom_back:" },
+    { 0,                 3, "        ld      bc, 1                   ; preserve default offset 1" },
+    { 0,                 1, "        push    bc" },
+    { 0,                 2, "        ld      a, $80" },
+    { 0,                 0, "dzx5cb_literals:" },
+    { CALL_LITERALS,     3, "        call    dzx5cb_elias            ; obtain length" },
+    { UNROLL_LITERALS,   1, "        add     a, a                    ; obtain length" },
+    { UNROLL_LITERALS,   2, "        jr      nz, dzx5cb_literals_skip" },
+    { UNROLL_LITERALS,   1, "        ld      a, (hl)                 ; load another group of 8 bits" },
+    { UNROLL_LITERALS,   1, "        dec     hl" },
+    { UNROLL_LITERALS,   1, "        rla" },
+    { UNROLL_LITERALS,   0, "dzx5cb_literals_skip:" },
+    { UNROLL_LITERALS,   3, "        call    c, dzx5cb_elias_backtrack" },
+    { 0,                 2, "        lddr                            ; copy literals" },
+    { 0,                 1, "        inc     c" },
+    { 0,                 1, "        add     a, a                    ; copy from last offset or another offset?" },
+    { 0,                 2, "        jr      c, dzx5cb_other_offset" },
+    { 0,                 0, "dzx5cb_last_offset:" },
+    { CALL_LAST,         3, "        call    dzx5cb_elias            ; obtain length" },
+    { UNROLL_LAST,       1, "        add     a, a                    ; obtain length" },
+    { UNROLL_LAST,       2, "        jr      nz, dzx5cb_last_offset_skip" },
+    { UNROLL_LAST,       1, "        ld      a, (hl)                 ; load another group of 8 bits" },
+    { UNROLL_LAST,       1, "        dec     hl" },
+    { UNROLL_LAST,       1, "        rla" },
+    { UNROLL_LAST,       0, "dzx5cb_last_offset_skip:" },
+    { UNROLL_LAST,       3, "        call    c, dzx5cb_elias_backtrack" },
+    { 0,                 0, "dzx5cb_copy:" },
+    { 0,                 1, "        ex      (sp), hl                ; preserve source, restore offset" },
+    { 0,                 1, "        push    hl                      ; preserve offset" },
+    { 0,                 1, "        add     hl, de                  ; calculate destination - offset" },
+    { 0,                 2, "        lddr                            ; copy from offset" },
+    { 0,                 1, "        inc     c" },
+    { 0,                 1, "        pop     hl                      ; restore offset" },
+    { 0,                 1, "        ex      (sp), hl                ; preserve offset, restore source" },
+    { 0,                 1, "        add     a, a                    ; copy from literals or another offset?" },
+    { 0,                 2, "        jr      nc, dzx5cb_literals" },
+    { 0,                 0, "dzx5cb_other_offset:" },
+    { 0,                 1, "        add     a, a                    ; copy from previous offset or new offset?" },
+    { 0,                 2, "        jr      nz, dzx5cb_other_offset_skip" },
+    { 0,                 1, "        ld      a, (hl)                 ; load another group of 8 bits" },
+    { 0,                 1, "        dec     hl" },
+    { 0,                 1, "        rla" },
+    { 0,                 0, "dzx5cb_other_offset_skip:" },
+    { 0,                 1, "        exx" },
+    { PREVIOUS_OFFSETS,  2, "        jr      nc, dzx5cb_prev_offset" },
+    { 0,                 0, "dzx5cb_new_offset:" },
+    { THIRD_OFFSET,      1, "        ex      de, hl                  ; copy 2nd last offset to 3rd last offset" },
+    { 0,                 1, "        pop     hl                      ; copy last offset to 2nd last offset" },
+    { 0,                 1, "        ld      b, a                    ; preserve next bit" },
+    { 0,                 1, "        add     a, a" },
+    { 0,                 1, "        exx" },
+    { LONG_OFFSETS,      3, "        call    dzx5cb_elias            ; obtain offset MSB" },
+    { LONG_OFFSETS,      1, "        dec     b" },
+    { LONG_OFFSETS,      1, "        ret     z                       ; check end marker" },
+    { LONG_OFFSETS,      1, "        dec     c                       ; adjust for positive offset" },
+    { LONG_OFFSETS,      1, "        ld      b, c" },
+    { SHORT_OFFSETS,     1, "        add     a, a                    ; obtain offset MSB" },
+    { SHORT_OFFSETS,     2, "        jr      nz, dzx5cb_new_offset_skip" },
+    { SHORT_OFFSETS,     1, "        ld      a, (hl)                 ; load another group of 8 bits" },
+    { SHORT_OFFSETS,     1, "        dec     hl" },
+    { SHORT_OFFSETS,     1, "        rla" },
+    { SHORT_OFFSETS,     0, "dzx5cb_new_offset_skip:" },
+    { SHORT_OFFSETS,     1, "        ret     c                       ; check end marker" },
+    { 0,                 1, "        ld      c, (hl)                 ; obtain offset LSB" },
+    { 0,                 1, "        dec     hl" },
+    { 0,                 1, "        inc     bc" },
+    { 0,                 1, "        push    bc                      ; preserve new offset" },
+    { 0,                 3, "        ld      bc, 1                   ; obtain length" },
+    { 0,                 1, "        exx" },
+    { 0,                 1, "        dec     b                       ; restore preserved bit" },
+    { 0,                 1, "        exx" },
+    { 0,                 3, "        call    m, dzx5cb_elias_backtrack" },
+    { 0,                 1, "        inc     bc" },
+    { 0,                 2, "        jr      dzx5cb_copy" },
+    { PREVIOUS_OFFSETS,  0, "dzx5cb_prev_offset:" },
+    { PREVIOUS_OFFSETS,  1, "        add     a, a                    ; copy from 2nd offset or 3rd offset?" },
+    { THIRD_OFFSET,      2, "        jr      nc, dzx5cb_second_offset" },
+    { THIRD_OFFSET,      1, "        ex      de, hl" },
+    { THIRD_OFFSET,      0, "dzx5cb_second_offset:" },
+    { PREVIOUS_OFFSETS,  1, "        ex      (sp), hl" },
+    { PREVIOUS_OFFSETS,  1, "        exx" },
+    { PREVIOUS_OFFSETS,  2, "        jr      dzx5cb_last_offset" },
+    { 0,                 0, "dzx5cb_elias_backtrack:" },
+    { 0,                 1, "        add     a, a" },
+    { 0,                 2, "        rl      c" },
+    { 0,                 2, "        rl      b" },
+    { 0,                 0, "dzx5cb_elias:" },
+    { 0,                 1, "        add     a, a                    ; inverted interlaced Elias gamma coding" },
+    { 0,                 2, "        jr      nz, dzx5cb_elias_skip" },
+    { 0,                 1, "        ld      a, (hl)                 ; load another group of 8 bits" },
+    { 0,                 1, "        dec     hl" },
+    { 0,                 1, "        rla" },
+    { 0,                 0, "dzx5cb_elias_skip:" },
+    { 0,                 2, "        jr      c, dzx5cb_elias_backtrack" },
+    { 0,                 1, "        ret" },
+    { 0,                 0, NULL }
+};
+
+int decoder_size(LINE *decoder, int features) {
+    int size = 0;
+
+    for (; decoder->text; decoder++)
+        if ((decoder->features & features) == decoder->features)
+            size += decoder->size;
+    return size;
+}
+
+/* T-states saved when length is read inline, instead of calling subroutine */
+int unroll_savings(int length, int backwards_mode) {
+    if (backwards_mode)
+        return length == 1 ? 24 : 12;
+    return length == 1 ? 18 : 5;
+}
+
+/* T-states saved when new offset MSB is read as single bit, instead of calling subroutine */
+int short_offset_savings(int end_marker, int backwards_mode) {
+    if (end_marker)
+        return backwards_mode ? 446 : 487;
+    return backwards_mode ? 46 : 39;
+}
+
+void write_decoder(char *name, BLOCK *optimal, int backwards_mode, int fast_mode) {
+    FILE *fp;
+    LINE *decoder = backwards_mode ? backward_decoder : forward_decoder;
+    BLOCK **blocks;
+    long types[NEW_OFFSET_BLOCK+1] = { 0, 0, 0, 0, 1 };   /* end marker is read as new offset */
+    long literal_savings = 0;
+    long last_savings = 0;
+    long savings = 0;
+    int offset1 = INITIAL_OFFSET;
+    int offset2 = 0;
+    int offset3 = 0;
+    int features = SHORT_OFFSETS;
+    int count;
+    int type;
+    int i;
+
+    /* identify which paths are used, and how often */
+    blocks = parse_blocks(optimal, &count);
+    for (i = 0; i < count; i++) {
+        type = block_type(blocks[i]->offset, &offset1, &offset2, &offset3);
+        types[type]++;
+        if (type == NEW_OFFSET_BLOCK && blocks[i]->offset > 256)
+            features = (features & ~SHORT_OFFSETS) | LONG_OFFSETS;
+        else if (type == LITERAL_BLOCK)
+            literal_savings += unroll_savings(blocks[i]->length, backwards_mode);
+        else if (type == LAST_OFFSET_BLOCK)
+            last_savings += unroll_savings(blocks[i]->length, backwards_mode);
+    }
+    free(blocks);
+
+    /* remove unused paths, saving the branches that select them */
+    if (types[SECOND_OFFSET_BLOCK] || types[THIRD_OFFSET_BLOCK])
+        features |= PREVIOUS_OFFSETS;
+    else
+        savings += types[NEW_OFFSET_BLOCK]*7;
+    if (types[THIRD_OFFSET_BLOCK])
+        features |= THIRD_OFFSET;
+    else
+        savings += types[NEW_OFFSET_BLOCK]*4 + types[SECOND_OFFSET_BLOCK]*12;
+
+    /* without new offsets above 256, offset MSB is either 1 or end marker */
+    if (features & SHORT_OFFSETS)
+        savings += (types[NEW_OFFSET_BLOCK]-1)*short_offset_savings(FALSE, backwards_mode) + short_offset_savings(TRUE, backwards_mode);
+
+    /* unroll common paths, only when speed is worth more bytes */
+    if (fast_mode && types[LITERAL_BLOCK]*UNROLL_SHARE >= count) {
+        features |= UNROLL_LITERALS;
+        savings += literal_savings;
+    } else {
+        features |= CALL_LITERALS | CALL_ELIAS;
+    }
+    if (fast_mode && types[LAST_OFFSET_BLOCK]*UNROLL_SHARE >= count) {
+        features |= UNROLL_LAST;
+        savings += last_savings;
+    } else {
+        features |= CALL_LAST | CALL_ELIAS;
+    }
+
+    fp = fopen(name, "w");
+    if (!fp) {
+        fprintf(stderr, "Error: Cannot create decoder file %s\n", name);
+        exit(1);
+    }
+    fprintf(fp, "; -----------------------------------------------------------------------------\n");
+    fprintf(fp, "; ZX5 decoder by Einar Saukas\n");
+    fprintf(fp, "; \"Custom\" version (%d bytes)%s\n", decoder_size(decoder, features), backwards_mode ? " - BACKWARDS VARIANT" : "");
+    if (!(features & PREVIOUS_OFFSETS))
+        fprintf(fp, "; Only for data without copies from 2nd or 3rd last offset\n");
+    else if (!(features & THIRD_OFFSET))
+        fprintf(fp, "; Only for data without copies from 3rd last offset\n");
+    if (features & SHORT_OFFSETS)
+        fprintf(fp, "; Only for data without new offsets above 256\n");
+    fprintf(fp, "; -----------------------------------------------------------------------------\n");
+    fprintf(fp, "; Parameters:\n");
+    fprintf(fp, ";   HL: %ssource address (compressed data)\n", backwards_mode ? "last " : "");
+    fprintf(fp, ";   DE: %sdestination address (decompressing)\n", backwards_mode ? "last " : "");
+    fprintf(fp, "; -----------------------------------------------------------------------------\n\n");
+    for (; decoder->text; decoder++)
+        if ((decoder->features & features) == decoder->features)
+            fprintf(fp, "%s\n", decoder->text);
+    fprintf(fp, "; -----------------------------------------------------------------------------\n");
+    if (fclose(fp)) {
+        fprintf(stderr, "Error: Cannot write decoder file %s\n", name);
+        exit(1);
+    }
+
+    decoder = backwards_mode ? backward_decoder : forward_decoder;
+    printf("Decoder %s with %d bytes (standard %d bytes), saving %ld T-states\n", name, decoder_size(decoder, features),
+           decoder_size(decoder, PREVIOUS_OFFSETS | THIRD_OFFSET | CALL_LITERALS | CALL_LAST | CALL_ELIAS | LONG_OFFSETS), savings);
+}
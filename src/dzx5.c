@@ -6,174 +6,421 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <setjmp.h>
+
+#include "zx5_stream.h"
+#include "trace.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define USE_THREADS
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/time.h>
+#else
+#include <time.h>
+#endif
 
 #define BUFFER_SIZE 65536  /* must be > MAX_OFFSET */
 #define INITIAL_OFFSET 1
+#define MAX_THREADS 64
+#define STREAM_CHUNK 4096
 
 #define FALSE 0
 #define TRUE 1
 
-FILE *ifp;
-FILE *ofp;
-char *input_name;
-char *output_name;
-unsigned char *input_data;
-unsigned char *output_data;
-size_t input_index;
-size_t output_index;
-size_t input_size;
-size_t output_size;
-size_t partial_counter;
-int bit_mask;
-int bit_value;
-int backtrack;
-int ahead_bit;
-
-int read_byte() {
-    if (input_index == partial_counter) {
-        input_index = 0;
-        partial_counter = fread(input_data, sizeof(char), BUFFER_SIZE, ifp);
-        input_size += partial_counter;
-        if (partial_counter == 0) {
-            fprintf(stderr, (input_size ? "Error: Truncated input file %s\n" : "Error: Empty input file %s\n"), input_name);
-            exit(1);
-        }
+typedef struct decoder_t {
+    FILE *ifp;
+    FILE *ofp;
+    char *input_name;
+    char *output_name;
+    unsigned char *input_data;
+    unsigned char *output_data;
+    size_t input_index;
+    size_t output_index;
+    size_t input_size;
+    size_t output_size;
+    size_t output_capacity;
+    size_t partial_counter;
+    int bit_mask;
+    int bit_value;
+    int backtrack;
+    int ahead_bit;
+    double range_time;
+    jmp_buf error;
+} DECODER;
+
+void fail(DECODER *d, char *message, char *name) {
+    fprintf(stderr, message, name);
+    longjmp(d->error, 1);
+}
+
+int read_byte(DECODER *d) {
+    if (d->input_index == d->partial_counter) {
+        if (!d->ifp)
+            fail(d, "Error: Truncated input file %s\n", d->input_name);
+        d->input_index = 0;
+        d->partial_counter = fread(d->input_data, sizeof(char), BUFFER_SIZE, d->ifp);
+        d->input_size += d->partial_counter;
+        if (d->partial_counter == 0)
+            fail(d, (d->input_size ? "Error: Truncated input file %s\n" : "Error: Empty input file %s\n"), d->input_name);
     }
-    return input_data[input_index++];
+    return d->input_data[d->input_index++];
 }
 
-int read_bit() {
-    if (backtrack) {
-        backtrack = FALSE;
-        return ahead_bit;
+int read_bit(DECODER *d) {
+    if (d->backtrack) {
+        d->backtrack = FALSE;
+        return d->ahead_bit;
     }
-    bit_mask >>= 1;
-    if (bit_mask == 0) {
-        bit_mask = 128;
-        bit_value = read_byte();
+    d->bit_mask >>= 1;
+    if (d->bit_mask == 0) {
+        d->bit_mask = 128;
+        d->bit_value = read_byte(d);
     }
-    return bit_value & bit_mask ? 1 : 0;
+    return d->bit_value & d->bit_mask ? 1 : 0;
 }
 
-int read_interlaced_elias_gamma(int inverted) {
+int read_interlaced_elias_gamma(DECODER *d) {
     int value = 1;
-    while (!read_bit()) {
-        value = value << 1 | read_bit() ^ inverted;
+    while (!read_bit(d)) {
+        value = value << 1 | read_bit(d);
     }
     return value;
 }
 
-void save_output() {
-    if (output_index != 0) {
-        if (fwrite(output_data, sizeof(char), output_index, ofp) != output_index) {
-            fprintf(stderr, "Error: Cannot write output file %s\n", output_name);
-            exit(1);
-        }
-        output_size += output_index;
-        output_index = 0;
+void save_output(DECODER *d) {
+    double start;
+
+    if (d->ofp && d->output_index != 0) {
+        trace_event("range", d->range_time, "\"first\":%lu,\"last\":%lu,\"input\":%lu", (unsigned long)d->output_size,
+                    (unsigned long)(d->output_size+d->output_index-1), (unsigned long)(d->input_size-d->partial_counter+d->input_index));
+        start = trace_clock();
+        if (fwrite(d->output_data, sizeof(char), d->output_index, d->ofp) != d->output_index)
+            fail(d, "Error: Cannot write output file %s\n", d->output_name);
+        trace_event("write", start, "\"size\":%lu", (unsigned long)d->output_index);
+        d->output_size += d->output_index;
+        d->output_index = 0;
+        d->range_time = trace_clock();
     }
 }
 
-void write_byte(int value) {
-    output_data[output_index++] = value;
-    if (output_index == BUFFER_SIZE) {
-        save_output();
+void grow_output(DECODER *d) {
+    unsigned char *output_data = (unsigned char *)realloc(d->output_data, d->output_capacity*2);
+
+    if (!output_data)
+        fail(d, "Error: Insufficient memory for output file %s\n", d->output_name);
+    d->output_data = output_data;
+    d->output_capacity *= 2;
+}
+
+void write_byte(DECODER *d, int value) {
+    d->output_data[d->output_index++] = value;
+    if (d->output_index == d->output_capacity) {
+        if (d->ofp)
+            save_output(d);
+        else
+            grow_output(d);
     }
 }
 
-void write_bytes(int offset, int length) {
+void write_bytes(DECODER *d, int offset, int length) {
     int i;
 
-    if (offset > output_size+output_index) {
-        fprintf(stderr, "Error: Invalid data in input file %s\n", input_name);
-        exit(1);
-    }
+    if (offset > d->output_size+d->output_index)
+        fail(d, "Error: Invalid data in input file %s\n", d->input_name);
     while (length-- > 0) {
-        i = output_index-offset;
-        write_byte(output_data[i >= 0 ? i : BUFFER_SIZE+i]);
+        i = d->output_index-offset;
+        write_byte(d, d->output_data[i >= 0 ? i : BUFFER_SIZE+i]);
     }
 }
 
-void decompress(int classic_mode) {
-    int last_offset1 = INITIAL_OFFSET;
-    int last_offset2 = 0;
-    int last_offset3 = 0;
-    int length;
-    int i;
+#define KERNEL(name) name##_standard
+#define CLASSIC_MODE FALSE
+#include "dzx5_kernel.h"
+#undef KERNEL
+#undef CLASSIC_MODE
 
-    input_data = (unsigned char *)malloc(BUFFER_SIZE);
-    output_data = (unsigned char *)malloc(BUFFER_SIZE);
-    if (!input_data || !output_data) {
-        fprintf(stderr, "Error: Insufficient memory\n");
-        exit(1);
+#define KERNEL(name) name##_classic
+#define CLASSIC_MODE TRUE
+#include "dzx5_kernel.h"
+#undef KERNEL
+#undef CLASSIC_MODE
+
+/* indexed by [classic_mode] */
+void (*decompress_kernels[2])(DECODER *d) = { decompress_standard, decompress_classic };
+
+/* decompress from input file to output file, or from memory to memory if no files are given */
+int decompress(DECODER *d, int classic_mode) {
+    if (setjmp(d->error))
+        return FALSE;
+
+    if (d->ifp) {
+        d->input_data = (unsigned char *)malloc(BUFFER_SIZE);
+        d->input_size = 0;
+        d->partial_counter = 0;
     }
+    d->output_data = (unsigned char *)malloc(BUFFER_SIZE);
+    if (!d->input_data || !d->output_data)
+        fail(d, "Error: Insufficient memory\n", NULL);
 
-    input_size = 0;
-    input_index = 0;
-    partial_counter = 0;
-    output_index = 0;
-    output_size = 0;
-    bit_mask = 0;
-    backtrack = FALSE;
-
-COPY_LITERALS:
-    length = read_interlaced_elias_gamma(FALSE);
-    for (i = 0; i < length; i++)
-        write_byte(read_byte());
-    if (read_bit())
-        goto COPY_FROM_OTHER_OFFSET;
-
-/*COPY_FROM_LAST_OFFSET:*/
-    length = read_interlaced_elias_gamma(FALSE);
-    write_bytes(last_offset1, length);
-    if (!read_bit())
-        goto COPY_LITERALS;
-
-COPY_FROM_OTHER_OFFSET:
-    if (!read_bit()) {
-
-/*COPY_FROM_PREVIOUS_OFFSET:*/
-        if (!read_bit()) {
-            i = last_offset2;
-            last_offset2 = last_offset1;
-            last_offset1 = i;
-        } else {
-            i = last_offset3;
-            last_offset3 = last_offset2;
-            last_offset2 = last_offset1;
-            last_offset1 = i;
+    d->input_index = 0;
+    d->output_index = 0;
+    d->output_size = 0;
+    d->output_capacity = BUFFER_SIZE;
+    d->bit_mask = 0;
+    d->backtrack = FALSE;
+    d->range_time = trace_clock();
+
+    decompress_kernels[classic_mode ? 1 : 0](d);
+    return TRUE;
+}
+
+/* decompress from input file to output file through streaming decoder, a chunk at a time */
+int decompress_stream(DECODER *d, int classic_mode) {
+    ZX5_STREAM *s = (ZX5_STREAM *)malloc(sizeof(ZX5_STREAM));
+    unsigned char *input_data = (unsigned char *)malloc(STREAM_CHUNK);
+    unsigned char *output_data = (unsigned char *)malloc(STREAM_CHUNK);
+    char *message = NULL;
+    size_t input_index = 0;
+    size_t partial_counter = 0;
+    int status = ZX5_STREAM_INPUT;
+    double start;
+
+    if (!s || !input_data || !output_data) {
+        message = "Error: Insufficient memory\n";
+    } else {
+        zx5_stream_init(s, classic_mode);
+        d->input_size = 0;
+        d->output_size = 0;
+        while (!message && status != ZX5_STREAM_END) {
+            if (input_index == partial_counter) {
+                input_index = 0;
+                partial_counter = fread(input_data, sizeof(char), STREAM_CHUNK, d->ifp);
+                d->input_size += partial_counter;
+                if (!partial_counter) {
+                    message = d->input_size ? "Error: Truncated input file %s\n" : "Error: Empty input file %s\n";
+                    break;
+                }
+            }
+            start = trace_clock();
+            status = zx5_stream_decode(s, input_data+input_index, partial_counter-input_index, output_data, STREAM_CHUNK);
+            if (s->output_used)
+                trace_event("range", start, "\"first\":%lu,\"last\":%lu,\"input\":%lu", (unsigned long)d->output_size,
+                            (unsigned long)(d->output_size+s->output_used-1), (unsigned long)(d->input_size-partial_counter+input_index+s->input_used));
+            input_index += s->input_used;
+            if (s->output_used && fwrite(output_data, sizeof(char), s->output_used, d->ofp) != s->output_used)
+                message = "Error: Cannot write output file %s\n";
+            d->output_size += s->output_used;
+            if (status == ZX5_STREAM_ERROR)
+                message = "Error: Invalid data in input file %s\n";
         }
-        length = read_interlaced_elias_gamma(FALSE);
-        write_bytes(last_offset1, length);
+        if (!message && (input_index != partial_counter || fread(input_data, sizeof(char), 1, d->ifp)))
+            message = "Error: Input file %s too long\n";
+    }
+    if (message)
+        fprintf(stderr, message, strstr(message, "output") ? d->output_name : d->input_name);
+
+    free(s);
+    free(input_data);
+    free(output_data);
+    return !message;
+}
+
+/* batch processing */
+
+char **batch_names;
+int batch_size;
+int batch_next;
+int batch_failed;
+int batch_classic_mode;
+int batch_forced_mode;
+size_t batch_input_size;
+size_t batch_output_size;
+#ifdef USE_THREADS
+pthread_mutex_t batch_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+void lock_batch() {
+#ifdef USE_THREADS
+    pthread_mutex_lock(&batch_mutex);
+#endif
+}
+
+void unlock_batch() {
+#ifdef USE_THREADS
+    pthread_mutex_unlock(&batch_mutex);
+#endif
+}
+
+double elapsed_seconds() {
+#ifdef USE_THREADS
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+    return now.tv_sec+now.tv_usec/1e6;
+#else
+    return (double)clock()/CLOCKS_PER_SEC;
+#endif
+}
+
+int decompress_file(DECODER *d) {
+    FILE *fp;
+    size_t name_size;
+    int success = FALSE;
+
+    /* determine output filename */
+    name_size = strlen(d->input_name);
+    if (name_size <= 4 || strcmp(d->input_name+name_size-4, ".zx5")) {
+        fprintf(stderr, "Error: Cannot infer output filename from %s\n", d->input_name);
+        return FALSE;
+    }
+    d->output_name = (char *)malloc(name_size);
+    if (!d->output_name) {
+        fprintf(stderr, "Error: Insufficient memory\n");
+        return FALSE;
+    }
+    strcpy(d->output_name, d->input_name);
+    d->output_name[name_size-4] = '\0';
+
+    d->ifp = NULL;
+    d->ofp = NULL;
+    d->input_data = NULL;
+    d->output_data = NULL;
+
+    /* read input file */
+    fp = fopen(d->input_name, "rb");
+    if (!fp) {
+        fprintf(stderr, "Error: Cannot access input file %s\n", d->input_name);
     } else {
+        fseek(fp, 0L, SEEK_END);
+        d->input_size = ftell(fp);
+        fseek(fp, 0L, SEEK_SET);
+        d->partial_counter = d->input_size;
+        d->input_data = (unsigned char *)malloc(d->input_size ? d->input_size : 1);
+        if (!d->input_data)
+            fprintf(stderr, "Error: Insufficient memory\n");
+        else if (fread(d->input_data, sizeof(char), d->input_size, fp) != d->input_size)
+            fprintf(stderr, "Error: Cannot read input file %s\n", d->input_name);
+        else if (!d->input_size)
+            fprintf(stderr, "Error: Empty input file %s\n", d->input_name);
+        else
+            success = TRUE;
+        fclose(fp);
+    }
 
-/*COPY_FROM_NEW_OFFSET:*/
-        ahead_bit = read_bit();
-        last_offset3 = last_offset2;
-        last_offset2 = last_offset1;
-        last_offset1 = read_interlaced_elias_gamma(!classic_mode);
-        if (last_offset1 == 256) {
-            save_output();
-            if (input_index != partial_counter) {
-                fprintf(stderr, "Error: Input file %s too long\n", input_name);
-                exit(1);
+    /* decompress in memory */
+    if (success)
+        success = decompress(d, batch_classic_mode);
+
+    /* write output file */
+    if (success) {
+        if (!batch_forced_mode && (fp = fopen(d->output_name, "rb")) != NULL) {
+            fclose(fp);
+            fprintf(stderr, "Error: Already existing output file %s\n", d->output_name);
+            success = FALSE;
+        } else if ((fp = fopen(d->output_name, "wb")) == NULL) {
+            fprintf(stderr, "Error: Cannot create output file %s\n", d->output_name);
+            success = FALSE;
+        } else {
+            if (fwrite(d->output_data, sizeof(char), d->output_index, fp) != d->output_index) {
+                fprintf(stderr, "Error: Cannot write output file %s\n", d->output_name);
+                success = FALSE;
             }
-            return;
+            fclose(fp);
+        }
+    }
+
+    free(d->input_data);
+    free(d->output_data);
+    free(d->output_name);
+    return success;
+}
+
+void *batch_worker(void *arg) {
+    DECODER *d = (DECODER *)malloc(sizeof(DECODER));
+    int success;
+
+    if (!d) {
+        fprintf(stderr, "Error: Insufficient memory\n");
+        exit(1);
+    }
+    for (;;) {
+        lock_batch();
+        if (batch_next == batch_size) {
+            unlock_batch();
+            break;
+        }
+        d->input_name = batch_names[batch_next++];
+        unlock_batch();
+
+        success = decompress_file(d);
+
+        lock_batch();
+        if (success) {
+            batch_input_size += d->input_size;
+            batch_output_size += d->output_index;
+        } else {
+            batch_failed++;
         }
-        last_offset1 = last_offset1*256-read_byte();
-        backtrack = TRUE;
-        length = read_interlaced_elias_gamma(FALSE)+1;
-        write_bytes(last_offset1, length);
+        unlock_batch();
     }
-    if (read_bit())
-        goto COPY_FROM_OTHER_OFFSET;
-    else
-        goto COPY_LITERALS;
+    free(d);
+    return NULL;
+}
+
+int decompress_batch(char **names, int size, int threads, int classic_mode, int forced_mode) {
+#ifdef USE_THREADS
+    pthread_t workers[MAX_THREADS];
+#endif
+    double seconds;
+    int i;
+
+    batch_names = names;
+    batch_size = size;
+    batch_next = 0;
+    batch_failed = 0;
+    batch_classic_mode = classic_mode;
+    batch_forced_mode = forced_mode;
+    batch_input_size = 0;
+    batch_output_size = 0;
+
+    seconds = elapsed_seconds();
+#ifdef USE_THREADS
+    if (threads <= 0)
+        threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads > MAX_THREADS)
+        threads = MAX_THREADS;
+    for (i = 0; i < threads; i++)
+        if (pthread_create(&workers[i], NULL, batch_worker, NULL))
+            break;
+    if (!i)
+        batch_worker(NULL);
+    while (i--)
+        pthread_join(workers[i], NULL);
+#else
+    batch_worker(NULL);
+#endif
+    seconds = elapsed_seconds()-seconds;
+    if (seconds <= 0)
+        seconds = 1e-6;
+
+    printf("%d file%s decompressed from %lu to %lu bytes in %.3f seconds (%.1f files/s, %.2f MB/s)%s\n",
+           size-batch_failed, (size-batch_failed == 1 ? "" : "s"), (unsigned long)batch_input_size, (unsigned long)batch_output_size,
+           seconds, (size-batch_failed)/seconds, batch_output_size/seconds/1e6, (batch_failed ? "" : "!"));
+    if (batch_failed)
+        printf("%d file%s failed!\n", batch_failed, (batch_failed == 1 ? "" : "s"));
+    return batch_failed ? 1 : 0;
 }
 
 int main(int argc, char *argv[]) {
+    DECODER d;
     int forced_mode = FALSE;
     int classic_mode = FALSE;
+    int batch_mode = FALSE;
+    int stream_mode = FALSE;
+    int threads = 0;
+    char *trace_name = NULL;
+    double start;
     int i;
 
     printf("DZX5 v2.0: Data decompressor by Einar Saukas\n");
@@ -184,66 +431,103 @@ int main(int argc, char *argv[]) {
             forced_mode = TRUE;
         } else if (!strcmp(argv[i], "-c")) {
             classic_mode = TRUE;
+        } else if (!strcmp(argv[i], "--batch")) {
+            batch_mode = TRUE;
+        } else if (!strcmp(argv[i], "--stream")) {
+            stream_mode = TRUE;
+        } else if (!strcmp(argv[i], "--trace") && i+1 < argc) {
+            trace_name = argv[++i];
+        } else if (!strncmp(argv[i], "-j", 2) && (threads = atoi(argv[i]+2)) > 0) {
+            continue;
         } else {
             fprintf(stderr, "Error: Invalid parameter %s\n", argv[i]);
             exit(1);
         }
     }
 
+    /* trace only covers a single file */
+    if (trace_name && batch_mode) {
+        fprintf(stderr, "Error: Cannot trace batch decompression\n");
+        exit(1);
+    }
+
+    /* decompress many files at once */
+    if (batch_mode && argc > i)
+        return decompress_batch(argv+i, argc-i, threads, classic_mode, forced_mode);
+
     /* determine output filename */
-    if (argc == i+1) {
-        input_name = argv[i];
-        input_size = strlen(input_name);
-        if (input_size > 4 && !strcmp(input_name+input_size-4, ".zx5")) {
-            input_size = strlen(input_name);
-            output_name = (char *)malloc(input_size);
-            strcpy(output_name, input_name);
-            output_name[input_size-4] = '\0';
+    if (argc == i+1 && !batch_mode) {
+        d.input_name = argv[i];
+        d.input_size = strlen(d.input_name);
+        if (d.input_size > 4 && !strcmp(d.input_name+d.input_size-4, ".zx5")) {
+            d.input_size = strlen(d.input_name);
+            d.output_name = (char *)malloc(d.input_size);
+            strcpy(d.output_name, d.input_name);
+            d.output_name[d.input_size-4] = '\0';
         } else {
             fprintf(stderr, "Error: Cannot infer output filename\n");
             exit(1);
         }
-    } else if (argc == i+2) {
-        input_name = argv[i];
-        output_name = argv[i+1];
+    } else if (argc == i+2 && !batch_mode) {
+        d.input_name = argv[i];
+        d.output_name = argv[i+1];
     } else {
-        fprintf(stderr, "Usage: %s [-f] [-c] input.zx5 [output]\n"
+        fprintf(stderr, "Usage: %s [-f] [-c] [--stream] [--trace FILE] input.zx5 [output]\n"
+                        "       %s [-f] [-c] [-jN] --batch input.zx5...\n"
                         "  -f      Force overwrite of output file\n"
-                        "  -c      Classic file format (v1.*)\n", argv[0]);
+                        "  -c      Classic file format (v1.*)\n"
+                        "  --stream  Decompress through resumable streaming decoder\n"
+                        "  --trace FILE  Save timeline of decompression in Chrome trace format\n"
+                        "  -jN     Use N threads in batch mode\n", argv[0], argv[0]);
         exit(1);
     }
 
     /* open input file */
-    ifp = fopen(input_name, "rb");
-    if (!ifp) {
-        fprintf(stderr, "Error: Cannot access input file %s\n", input_name);
+    d.ifp = fopen(d.input_name, "rb");
+    if (!d.ifp) {
+        fprintf(stderr, "Error: Cannot access input file %s\n", d.input_name);
         exit(1);
     }
 
     /* check output file */
-    if (!forced_mode && fopen(output_name, "rb") != NULL) {
-        fprintf(stderr, "Error: Already existing output file %s\n", output_name);
+    if (!forced_mode && fopen(d.output_name, "rb") != NULL) {
+        fprintf(stderr, "Error: Already existing output file %s\n", d.output_name);
         exit(1);
     }
 
     /* create output file */
-    ofp = fopen(output_name, "wb");
-    if (!ofp) {
-        fprintf(stderr, "Error: Cannot create output file %s\n", output_name);
+    d.ofp = fopen(d.output_name, "wb");
+    if (!d.ofp) {
+        fprintf(stderr, "Error: Cannot create output file %s\n", d.output_name);
+        exit(1);
+    }
+
+    /* start timeline */
+    if (trace_name && !trace_open(trace_name, "dzx5")) {
+        fprintf(stderr, "Error: Cannot create trace file %s\n", trace_name);
         exit(1);
     }
+    start = trace_clock();
 
     /* generate output file */
-    decompress(classic_mode);
+    if (!(stream_mode ? decompress_stream(&d, classic_mode) : decompress(&d, classic_mode)))
+        exit(1);
+    trace_event("decompress", start, "\"input\":%lu,\"output\":%lu", (unsigned long)d.input_size, (unsigned long)d.output_size);
 
     /* close input file */
-    fclose(ifp);
+    fclose(d.ifp);
 
     /* close output file */
-    fclose(ofp);
+    fclose(d.ofp);
+
+    /* finish timeline */
+    if (!trace_close()) {
+        fprintf(stderr, "Error: Cannot write trace file %s\n", trace_name);
+        exit(1);
+    }
 
     /* done! */
-    printf("File decompressed from %lu to %lu bytes!\n", (unsigned long)input_size, (unsigned long)output_size);
+    printf("File decompressed from %lu to %lu bytes!\n", (unsigned long)d.input_size, (unsigned long)d.output_size);
 
     return 0;
 }
@@ -0,0 +1,80 @@
+/*
+ * ZX5 decompressor - by Einar Saukas
+ * https://github.com/einar-saukas/ZX5
+ */
+
+/*
+ * ZX5 decompressor kernel, included once per file format variant with the
+ * following parameters defined:
+ *
+ *   KERNEL(name)    name suffixed with the variant
+ *   CLASSIC_MODE    TRUE for classic file format (v1.*)
+ */
+
+int KERNEL(read_offset_msb)(DECODER *d) {
+    int value = 1;
+    while (!read_bit(d)) {
+        value = value << 1 | read_bit(d) ^ !CLASSIC_MODE;
+    }
+    return value;
+}
+
+void KERNEL(decompress)(DECODER *d) {
+    int last_offset1 = INITIAL_OFFSET;
+    int last_offset2 = 0;
+    int last_offset3 = 0;
+    int length;
+    int i;
+
+COPY_LITERALS:
+    length = read_interlaced_elias_gamma(d);
+    for (i = 0; i < length; i++)
+        write_byte(d, read_byte(d));
+    if (read_bit(d))
+        goto COPY_FROM_OTHER_OFFSET;
+
+/*COPY_FROM_LAST_OFFSET:*/
+    length = read_interlaced_elias_gamma(d);
+    write_bytes(d, last_offset1, length);
+    if (!read_bit(d))
+        goto COPY_LITERALS;
+
+COPY_FROM_OTHER_OFFSET:
+    if (!read_bit(d)) {
+
+/*COPY_FROM_PREVIOUS_OFFSET:*/
+        if (!read_bit(d)) {
+            i = last_offset2;
+            last_offset2 = last_offset1;
+            last_offset1 = i;
+        } else {
+            i = last_offset3;
+            last_offset3 = last_offset2;
+            last_offset2 = last_offset1;
+            last_offset1 = i;
+        }
+        length = read_interlaced_elias_gamma(d);
+        write_bytes(d, last_offset1, length);
+    } else {
+
+/*COPY_FROM_NEW_OFFSET:*/
+        d->ahead_bit = read_bit(d);
+        last_offset3 = last_offset2;
+        last_offset2 = last_offset1;
+        last_offset1 = KERNEL(read_offset_msb)(d);
+        if (last_offset1 == 256) {
+            save_output(d);
+            if (d->input_index != d->partial_counter)
+                fail(d, "Error: Input file %s too long\n", d->input_name);
+            return;
+        }
+        last_offset1 = last_offset1*256-read_byte(d);
+        d->backtrack = TRUE;
+        length = read_interlaced_elias_gamma(d)+1;
+        write_bytes(d, last_offset1, length);
+    }
+    if (read_bit(d))
+        goto COPY_FROM_OTHER_OFFSET;
+    else
+        goto COPY_LITERALS;
+}
@@ -0,0 +1,125 @@
+/*
+ * (c) Copyright 2021 by Einar Saukas. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * The name of its author may not be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "zx5.h"
+
+#define SAMPLE_WINDOWS 4
+#define SAMPLE_RATIO 16
+#define MIN_SAMPLE_SIZE 64
+#define SAMPLE_COLLECT_MINIMUM (1L << 14)
+
+/* number of offsets visited by optimize() from first to last index */
+double offset_sweep(int first, int last, int offset_limit) {
+    double total = 0;
+    int index;
+
+    for (index = first; index <= last; index++)
+        total += index > offset_limit ? offset_limit : index;
+    return total;
+}
+
+/* measure optimize() from start to end, with previous bytes as dictionary like a windowed segment */
+void sample(unsigned char *input_data, int start, int end, int offset_limit, int prune_mode, double *seconds, double *blocks, double *entries) {
+    int base = start > offset_limit ? start-offset_limit : 0;
+    clock_t begin;
+
+    collect_after(SAMPLE_COLLECT_MINIMUM);
+    reset_memory();
+    begin = clock();
+    optimize(input_data+base, end-base, start-base, offset_limit, prune_mode, FALSE);
+    *seconds = (double)(clock()-begin)/CLOCKS_PER_SEC;
+    *blocks = allocated_blocks();
+    *entries = allocated_entries();
+    collect_after(0);
+    reset_memory();
+}
+
+void forecast(unsigned char *input_data, int input_size, int skip, int offset_limit, int prune_mode, int windowed_mode, int processes, char *mode_name) {
+    double seconds[2];
+    double blocks[2];
+    double entries[2];
+    double seconds_rate;
+    double estimated_seconds = 0;
+    double estimated_blocks = COLLECT_MINIMUM;
+    double estimated_entries = 0;
+    double memory;
+    int region_size = (input_size-skip+SAMPLE_WINDOWS-1)/SAMPLE_WINDOWS;
+    int window_size = region_size/SAMPLE_RATIO;
+    int region_start;
+    int region_end;
+    int start;
+    int middle;
+    int end;
+    int size;
+    int i;
+
+    /* measure a window centered on each region of input, so slow parts anywhere are noticed */
+    if (window_size < MIN_SAMPLE_SIZE)
+        window_size = MIN_SAMPLE_SIZE;
+    for (i = 0; i < SAMPLE_WINDOWS; i++) {
+        region_start = skip+i*region_size;
+        region_end = region_start+region_size < input_size ? region_start+region_size : input_size;
+        if (region_start >= region_end)
+            break;
+        start = region_start+(region_end-region_start-window_size)/2;
+        if (start < region_start)
+            start = region_start;
+        end = start+window_size < region_end ? start+window_size : region_end;
+        middle = start+(end-start)/2;
+
+        /* extrapolate time by offsets visited in second half, once initial state is built */
+        sample(input_data, start, middle, offset_limit, prune_mode, &seconds[0], &blocks[0], &entries[0]);
+        sample(input_data, start, end, offset_limit, prune_mode, &seconds[1], &blocks[1], &entries[1]);
+        seconds_rate = seconds[1] > seconds[0] ? (seconds[1]-seconds[0])/offset_sweep(middle, end-1, offset_limit) :
+                                                 seconds[1]/offset_sweep(start, end-1, offset_limit);
+        estimated_seconds += seconds_rate*offset_sweep(region_start, region_end-1, offset_limit);
+
+        /* collector keeps memory proportional to blocks in use, so busiest region sets the peak */
+        if (estimated_blocks < blocks[1])
+            estimated_blocks = blocks[1];
+        if (estimated_entries < entries[1])
+            estimated_entries = entries[1];
+    }
+
+    if (windowed_mode) {
+        /* concurrent segments each need their own memory */
+        size = offset_limit*SEGMENT_SCALE < input_size-skip ? offset_limit*SEGMENT_SCALE : input_size-skip;
+        processes = segment_processes(processes, (input_size-skip+offset_limit*SEGMENT_SCALE-1)/(offset_limit*SEGMENT_SCALE));
+        estimated_seconds /= processes;
+        estimated_blocks *= processes;
+        estimated_entries *= processes;
+        memory = estimated_blocks*sizeof(BLOCK) + estimated_entries*sizeof(ENTRY) +
+                 processes*((double)(size+offset_limit)*sizeof(CELL) + 2.0*(offset_limit+1)*sizeof(CELL)) + input_size;
+    } else {
+        memory = estimated_blocks*sizeof(BLOCK) + estimated_entries*sizeof(ENTRY) + (double)input_size*sizeof(CELL) +
+                 2.0*(offset_ceiling(input_size-1, offset_limit)+1)*sizeof(CELL) + input_size;
+    }
+
+    printf("Estimated %s compression: %.1f seconds, %.0f blocks, %.0f entries, %.1f MB\n", mode_name, estimated_seconds, estimated_blocks, estimated_entries, memory/(1024*1024));
+}
@@ -25,19 +25,114 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#endif
 
 #include "zx5.h"
 
-#define QTY_BLOCKS  10000
-#define QTY_ENTRIES 10000
+#define ARENA_INITIAL_SIZE (1L << 22)
+#define ARENA_MAXIMUM_SIZE (1L << 28)
+#define PERMANENT_GENERATION -1
 
-BLOCK *ghost_root_block = NULL;
-BLOCK *dead_array_block = NULL;
-int dead_array_block_size = 0;
+typedef struct region_t {
+    struct region_t *next;
+    size_t size;
+} REGION;
+
+typedef struct arena_t {
+    REGION *first;
+    REGION *current;
+    char *next;
+    char *limit;
+} ARENA;
+
+ARENA block_arena = { NULL, NULL, NULL, NULL };
+ARENA entry_arena = { NULL, NULL, NULL, NULL };
 
+BLOCK *ghost_root_block = NULL;
 ENTRY *ghost_root_entry = NULL;
-ENTRY *dead_array_entry = NULL;
-int dead_array_entry_size = 0;
+
+long block_count = 0;
+long entry_count = 0;
+
+/* blocks are reclaimed by marking those still reachable with a new generation,
+ * except blocks in permanent generation that are never reclaimed */
+int generation = 0;
+long collect_minimum = COLLECT_MINIMUM;
+long collect_limit = COLLECT_MINIMUM;
+
+REGION *map_region(size_t size) {
+    REGION *region;
+
+#if defined(MAP_ANONYMOUS)
+    region = (REGION *)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (region == (REGION *)MAP_FAILED)
+        region = NULL;
+#if defined(MADV_HUGEPAGE)
+    if (region)
+        madvise(region, size, MADV_HUGEPAGE);
+#endif
+#else
+    region = (REGION *)malloc(size);
+#endif
+    if (!region) {
+        fprintf(stderr, "Error: Insufficient memory\n");
+        exit(1);
+    }
+    region->next = NULL;
+    region->size = size;
+    return region;
+}
+
+void enter_region(ARENA *arena, REGION *region) {
+    arena->current = region;
+    arena->next = (char *)(region+1);
+    arena->limit = (char *)region+region->size;
+}
+
+void *arena_allocate(ARENA *arena, size_t size) {
+    if (!arena->first) {
+        arena->first = map_region(ARENA_INITIAL_SIZE);
+        enter_region(arena, arena->first);
+    } else if (arena->next+size > arena->limit) {
+        /* reuse regions from previous runs, otherwise grow geometrically */
+        if (!arena->current->next)
+            arena->current->next = map_region(arena->current->size < ARENA_MAXIMUM_SIZE ? arena->current->size*2 : ARENA_MAXIMUM_SIZE);
+        enter_region(arena, arena->current->next);
+    }
+    arena->next += size;
+    return arena->next-size;
+}
+
+void arena_reset(ARENA *arena) {
+    if (arena->first)
+        enter_region(arena, arena->first);
+}
+
+void reset_memory() {
+    arena_reset(&block_arena);
+    arena_reset(&entry_arena);
+    ghost_root_block = NULL;
+    ghost_root_entry = NULL;
+    block_count = 0;
+    entry_count = 0;
+    collect_limit = collect_minimum;
+}
+
+/* collect sooner than usual, so short runs measure blocks in use instead of blocks ever allocated (0 for default) */
+void collect_after(long minimum) {
+    collect_minimum = minimum ? minimum : COLLECT_MINIMUM;
+    collect_limit = collect_minimum;
+}
+
+long allocated_blocks() {
+    return block_count;
+}
+
+long allocated_entries() {
+    return entry_count;
+}
 
 BLOCK *allocate_block(int bits, int offset, int length, BLOCK *chain) {
     BLOCK *ptr;
@@ -46,38 +141,56 @@ BLOCK *allocate_block(int bits, int offset, int length, BLOCK *chain) {
         ptr = ghost_root_block;
         ghost_root_block = ptr->chain;
     } else {
-        if (!dead_array_block_size) {
-            dead_array_block = (BLOCK *)malloc(QTY_BLOCKS*sizeof(BLOCK));
-            if (!dead_array_block) {
-                fprintf(stderr, "Error: Insufficient memory\n");
-                exit(1);
-            }
-            dead_array_block_size = QTY_BLOCKS;
-        }
-        ptr = &dead_array_block[--dead_array_block_size];
+        ptr = (BLOCK *)arena_allocate(&block_arena, sizeof(BLOCK));
+        block_count++;
     }
     ptr->bits = bits;
     ptr->offset = offset;
     ptr->length = length;
-    if (chain)
-        chain->references++;
     ptr->chain = chain;
-    ptr->references = 0;
+    ptr->generation = 0;
     return ptr;
 }
 
-void assign_block(BLOCK **ptr, BLOCK *chain) {
-    BLOCK *last = *ptr;
+int collection_due() {
+    return !ghost_root_block && block_count >= collect_limit;
+}
+
+void begin_collection() {
+    generation++;
+}
 
-    if (chain)
-        chain->references++;
-    if (last && !--last->references) {
-        while (last->chain && !--last->chain->references) 
-            last = last->chain;
-        last->chain = ghost_root_block;
-        ghost_root_block = *ptr;
+void mark_blocks(BLOCK *chain) {
+    /* stop at blocks already reached through another chain */
+    for (; chain && chain->generation != generation && chain->generation != PERMANENT_GENERATION; chain = chain->chain)
+        chain->generation = generation;
+}
+
+void keep_blocks(BLOCK *chain) {
+    for (; chain && chain->generation != PERMANENT_GENERATION; chain = chain->chain)
+        chain->generation = PERMANENT_GENERATION;
+}
+
+void sweep_blocks() {
+    REGION *region;
+    BLOCK *ptr;
+    char *limit;
+    long live = 0;
+
+    ghost_root_block = NULL;
+    for (region = block_arena.first; region; region = region != block_arena.current ? region->next : NULL) {
+        limit = region != block_arena.current ? (char *)region+region->size : block_arena.next;
+        for (ptr = (BLOCK *)(region+1); (char *)(ptr+1) <= limit; ptr++)
+            if (ptr->generation != generation && ptr->generation != PERMANENT_GENERATION) {
+                ptr->chain = ghost_root_block;
+                ghost_root_block = ptr;
+            } else {
+                live++;
+            }
     }
-    *ptr = chain;
+
+    /* allow memory to grow up to twice as much as still in use before next collection */
+    collect_limit = live*2 > collect_minimum ? live*2 : collect_minimum;
 }
 
 ENTRY *allocate_entry(int offset1, int offset2, int offset3) {
@@ -86,22 +199,15 @@ ENTRY *allocate_entry(int offset1, int offset2, int offset3) {
     if (ghost_root_entry) {
         ptr = ghost_root_entry;
         ghost_root_entry = ptr->next;
-        assign_block(&ptr->block, NULL);
     } else {
-        if (!dead_array_entry_size) {
-            dead_array_entry = (ENTRY *)malloc(QTY_ENTRIES*sizeof(ENTRY));
-            if (!dead_array_entry) {
-                fprintf(stderr, "Error: Insufficient memory\n");
-                exit(1);
-            }
-            dead_array_entry_size = QTY_ENTRIES;
-        }
-        ptr = &dead_array_entry[--dead_array_entry_size];
-        ptr->block = NULL;
+        ptr = (ENTRY *)arena_allocate(&entry_arena, sizeof(ENTRY));
+        entry_count++;
     }
+    ptr->block = NULL;
     ptr->offset1 = offset1;
     ptr->offset2 = offset2;
     ptr->offset3 = offset3;
+    ptr->delta = 0;
     return ptr;
 }
 
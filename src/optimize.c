@@ -28,18 +28,45 @@
 #include <limits.h>
 
 #include "zx5.h"
+#include "trace.h"
 
 #define MAX_SCALE 55
+#define LIVE_BITS 32
+#define SNAPSHOT_INTERVAL 4096
+#define TRACE_WINDOW 1024
+
+int *lower_bound = NULL;
+int upper_bound = INT_MAX;
+
+/* under delta constraint, cells keep entries trading bits for delta instead of fewest bits only */
+int delta_mode = FALSE;
+int delta_limit = INT_MAX;
+int lowest_delta_mode = FALSE;
+int optimal_delta = 0;
 
 int offset_ceiling(int index, int offset_limit) {
     return index > offset_limit ? offset_limit : index < INITIAL_OFFSET ? INITIAL_OFFSET : index;
 }
 
-int elias_gamma_bits(int value) {
-    int bits = 1;
-    while (value >>= 1)
-        bits += 2;
-    return bits;
+int pruned(int bits, int index) {
+    return lower_bound && bits+lower_bound[index] > upper_bound;
+}
+
+/* under delta constraint, a repeated offset would be written with fewer bits than counted */
+int reused_offset(ENTRY *entry, int offset) {
+    return entry->offset1 == offset || entry->offset2 == offset || entry->offset3 == offset;
+}
+
+/* delta after a block, since bytes written after each earlier read grow by block output and shrink by block input */
+int block_delta(ENTRY *entry, int bits, int length) {
+    int delta = entry->delta+(bits+7)/8-(entry->block->bits+7)/8-length;
+
+    return delta > 0 ? delta : 0;
+}
+
+/* delta reported by compress(), including end marker */
+int final_delta(ENTRY *entry) {
+    return entry->delta+(entry->block->bits+27)/8-(entry->block->bits+7)/8;
 }
 
 int hash(int offset1, int offset2, int offset3) {
@@ -94,12 +121,92 @@ ENTRY *find_entry(CELL *cell, int offset1, int offset2, int offset3) {
     return create_entry(&cell->table[i], offset1, offset2, offset3);
 }
 
+/* no more bits and no higher delta, at same position within last byte so later blocks also add bytes at same points */
+int dominates(int bits, int delta, int other_bits, int other_delta) {
+    return bits <= other_bits && delta <= other_delta && (other_bits-bits)%8 == 0;
+}
+
+/* drop entries worse than given bits and delta */
+void remove_dominated(CELL *cell, int bits, int delta) {
+    ENTRY *entry;
+    ENTRY *next;
+    ENTRY *last = NULL;
+    int i;
+
+    for (i = 0; i < HASH_SIZE; i++)
+        if (cell->table[i]) {
+            entry = cell->table[i]->next;
+            cell->table[i]->next = NULL;
+            cell->table[i] = NULL;
+            for (; entry; entry = next) {
+                next = entry->next;
+                if (dominates(bits, delta, entry->block->bits, entry->delta) && (entry->block->bits > bits || entry->delta > delta)) {
+                    entry->next = entry;
+                    free_list_entries(entry);
+                } else {
+                    entry->next = cell->table[i] ? cell->table[i] : entry;
+                    if (cell->table[i])
+                        last->next = entry;
+                    else
+                        cell->table[i] = entry;
+                    last = entry;
+                }
+            }
+        }
+}
+
+/* new entry under delta constraint, unless another one is at least as good (keeping other offsets only with fewest bits) */
+ENTRY *pareto_entry(CELL *cell, int bits, int index, int delta, int offset1, int offset2, int offset3) {
+    ENTRY *entry;
+    int i;
+
+    if (!cell->bits || cell->index != index) {
+        erase_table(cell);
+        cell->bits = bits;
+        cell->index = index;
+    }
+    for (i = 0; i < HASH_SIZE; i++)
+        for (entry = cell->table[i]; entry; entry = entry->next != cell->table[i] ? entry->next : NULL)
+            if (dominates(entry->block->bits, entry->delta, bits, delta) && (entry->block->bits < bits || entry->delta < delta || bits > cell->bits ||
+                (entry->offset1 == offset1 && entry->offset2 == offset2 && entry->offset3 == offset3)))
+                return NULL;
+    remove_dominated(cell, bits, delta);
+    if (cell->bits > bits)
+        cell->bits = bits;
+    entry = create_entry(&cell->table[hash(offset1, offset2, offset3)], offset1, offset2, offset3);
+    entry->delta = delta;
+    return entry;
+}
+
+/* block after a single entry under delta constraint, with bits and delta of its own */
+void add_pareto_block(CELL *dest, int index, ENTRY *entry_src, int cost, int offset, int length, int offset1, int offset2, int offset3) {
+    ENTRY *entry_dest;
+    int bits = entry_src->block->bits+cost;
+
+    entry_dest = pareto_entry(dest, bits, index, block_delta(entry_src, bits, length), offset1, offset2, offset3);
+    if (entry_dest)
+        entry_dest->block = allocate_block(bits, offset, length, entry_src->block);
+}
+
+/* under delta constraint, any entry at index may still be an optimal choice */
+void merge_pareto(CELL *dest, CELL *src, int index) {
+    ENTRY *entry_src;
+    ENTRY *entry_dest;
+    int i;
+
+    if (src->bits && src->index == index)
+        for (i = 0; i < HASH_SIZE; i++)
+            for (entry_src = src->table[i]; entry_src; entry_src = entry_src->next != src->table[i] ? entry_src->next : NULL)
+                if ((entry_dest = pareto_entry(dest, entry_src->block->bits, index, entry_src->delta, entry_src->offset1, entry_src->offset2, entry_src->offset3)) != NULL)
+                    entry_dest->block = entry_src->block;
+}
+
 void add_first_block(CELL *dest, int bits, int index, int offset, int length) {
     ENTRY *entry_dest;
 
     prepare_cell(dest, bits, index);
     entry_dest = find_entry(dest, offset, 0, 0);
-    assign_block(&entry_dest->block, allocate_block(bits, offset, length, NULL));
+    entry_dest->block = allocate_block(bits, offset, length, NULL);
 }
 
 void add_literal_block(CELL *dest, int index, CELL *src) {
@@ -107,14 +214,21 @@ void add_literal_block(CELL *dest, int index, CELL *src) {
     ENTRY *entry_dest;
     int i;
     int length = index-src->index;
-    int bits = src->bits + 1 + elias_gamma_bits(length) + length*8;
+    int bits = src->bits + 1 + elias_costs[length] + length*8;
 
+    if (delta_mode) {
+        for (i = 0; i < HASH_SIZE; i++)
+            for (entry_src = src->table[i]; entry_src; entry_src = entry_src->next != src->table[i] ? entry_src->next : NULL)
+                add_pareto_block(dest, index, entry_src, bits-src->bits, 0, length, entry_src->offset1, entry_src->offset2, entry_src->offset3);
+        return;
+    }
     prepare_cell(dest, bits, index);
-    for (i = 0; i < HASH_SIZE; i++)
-        for (entry_src = src->table[i]; entry_src; entry_src = entry_src->next != src->table[i] ? entry_src->next : NULL) {
-            entry_dest = create_entry(&dest->table[i], entry_src->offset1, entry_src->offset2, entry_src->offset3);
-            assign_block(&entry_dest->block, allocate_block(bits, 0, length, entry_src->block));
-        }
+    if (!pruned(bits, index))
+        for (i = 0; i < HASH_SIZE; i++)
+            for (entry_src = src->table[i]; entry_src; entry_src = entry_src->next != src->table[i] ? entry_src->next : NULL) {
+                entry_dest = create_entry(&dest->table[i], entry_src->offset1, entry_src->offset2, entry_src->offset3);
+                entry_dest->block = allocate_block(bits, 0, length, entry_src->block);
+            }
 }
 
 void add_last_offset_block(CELL *dest, int index, int offset, CELL *src) {
@@ -122,14 +236,21 @@ void add_last_offset_block(CELL *dest, int index, int offset, CELL *src) {
     ENTRY *entry_dest;
     int i;
     int length = index-src->index;
-    int bits = src->bits + 1 + elias_gamma_bits(length);
+    int bits = src->bits + 1 + elias_costs[length];
 
+    if (delta_mode) {
+        for (i = 0; i < HASH_SIZE; i++)
+            for (entry_src = src->table[i]; entry_src; entry_src = entry_src->next != src->table[i] ? entry_src->next : NULL)
+                add_pareto_block(dest, index, entry_src, bits-src->bits, offset, length, entry_src->offset1, entry_src->offset2, entry_src->offset3);
+        return;
+    }
     prepare_cell(dest, bits, index);
-    for (i = 0; i < HASH_SIZE; i++)
-        for (entry_src = src->table[i]; entry_src; entry_src = entry_src->next != src->table[i] ? entry_src->next : NULL) {
-            entry_dest = create_entry(&dest->table[i], entry_src->offset1, entry_src->offset2, entry_src->offset3);
-            assign_block(&entry_dest->block, allocate_block(bits, offset, length, entry_src->block));
-        }
+    if (!pruned(bits, index))
+        for (i = 0; i < HASH_SIZE; i++)
+            for (entry_src = src->table[i]; entry_src; entry_src = entry_src->next != src->table[i] ? entry_src->next : NULL) {
+                entry_dest = create_entry(&dest->table[i], entry_src->offset1, entry_src->offset2, entry_src->offset3);
+                entry_dest->block = allocate_block(bits, offset, length, entry_src->block);
+            }
 }
 
 int add_previous_offset_block(CELL *dest, int index, int offset, CELL *src) {
@@ -137,9 +258,18 @@ int add_previous_offset_block(CELL *dest, int index, int offset, CELL *src) {
     ENTRY *entry_dest;
     int i;
     int length = index-src->index;
-    int bits = src->bits + 3 + elias_gamma_bits(length);
+    int bits = src->bits + 3 + elias_costs[length];
     int found = FALSE;
 
+    /* under delta constraint, a new offset may still trade bits for delta */
+    if (delta_mode) {
+        for (i = 0; i < HASH_SIZE; i++)
+            for (entry_src = src->table[i]; entry_src; entry_src = entry_src->next != src->table[i] ? entry_src->next : NULL)
+                if (entry_src->offset2 == offset || entry_src->offset3 == offset)
+                    add_pareto_block(dest, index, entry_src, bits-src->bits, offset, length, offset, entry_src->offset1,
+                                     entry_src->offset2 != offset ? entry_src->offset2 : entry_src->offset3);
+        return FALSE;
+    }
     if (!dest->bits || dest->index != index || dest->bits >= bits)
         for (i = 0; i < HASH_SIZE; i++)
             for (entry_src = src->table[i]; entry_src; entry_src = entry_src->next != src->table[i] ? entry_src->next : NULL)
@@ -148,9 +278,11 @@ int add_previous_offset_block(CELL *dest, int index, int offset, CELL *src) {
                         prepare_cell(dest, bits, index);
                         found = TRUE;
                     }
+                    if (pruned(bits, index))
+                        return found;
                     entry_dest = find_entry(dest, offset, entry_src->offset1, entry_src->offset2 != offset ? entry_src->offset2 : entry_src->offset3);
                     if (!entry_dest->block)
-                        assign_block(&entry_dest->block, allocate_block(bits, offset, length, entry_src->block));
+                        entry_dest->block = allocate_block(bits, offset, length, entry_src->block);
                 }
     return found;
 }
@@ -160,15 +292,23 @@ int add_new_offset_block(CELL *dest, int index, int offset, CELL *src) {
     ENTRY *entry_dest;
     int i;
     int length = index-src->index;
-    int bits = src->bits + 10 + elias_gamma_bits((offset-1)/256+1) + elias_gamma_bits(length-1);
+    int bits = src->bits + offset_costs[offset] + elias_costs[length-1];
 
-    if (prepare_cell(dest, bits, index)) {
+    if (delta_mode) {
         for (i = 0; i < HASH_SIZE; i++)
-            for (entry_src = src->table[i]; entry_src; entry_src = entry_src->next != src->table[i] ? entry_src->next : NULL) {
-                entry_dest = find_entry(dest, offset, entry_src->offset1, entry_src->offset2);
-                if (!entry_dest->block)
-                    assign_block(&entry_dest->block, allocate_block(bits, offset, length, entry_src->block));
-            }
+            for (entry_src = src->table[i]; entry_src; entry_src = entry_src->next != src->table[i] ? entry_src->next : NULL)
+                if (!reused_offset(entry_src, offset))
+                    add_pareto_block(dest, index, entry_src, bits-src->bits, offset, length, offset, entry_src->offset1, entry_src->offset2);
+        return FALSE;
+    }
+    if (prepare_cell(dest, bits, index)) {
+        if (!pruned(bits, index))
+            for (i = 0; i < HASH_SIZE; i++)
+                for (entry_src = src->table[i]; entry_src; entry_src = entry_src->next != src->table[i] ? entry_src->next : NULL) {
+                    entry_dest = find_entry(dest, offset, entry_src->offset1, entry_src->offset2);
+                    if (!entry_dest->block)
+                        entry_dest->block = allocate_block(bits, offset, length, entry_src->block);
+                }
         return TRUE;
     }
     return FALSE;
@@ -185,7 +325,7 @@ void merge_blocks(CELL *dest, CELL *src) {
         for (entry_src = src->table[i]; entry_src; entry_src = entry_src->next != src->table[i] ? entry_src->next : NULL) {
             entry_dest = find_entry(dest, entry_src->offset1, entry_src->offset2, entry_src->offset3);
             if (!entry_dest->block)
-                assign_block(&entry_dest->block, entry_src->block);
+                entry_dest->block = entry_src->block;
         }
 }
 
@@ -198,75 +338,303 @@ BLOCK *find_any_block(CELL *cell) {
     return NULL;
 }
 
-BLOCK* optimize(unsigned char *input_data, int input_size, int skip, int offset_limit) {
+/* fewest bits within delta limit, or lowest delta first */
+BLOCK *find_delta_block(CELL *cell) {
+    ENTRY *entry;
+    BLOCK *block = NULL;
+    int found_delta = INT_MAX;
+    int delta;
+    int i;
+
+    for (i = 0; i < HASH_SIZE; i++)
+        for (entry = cell->table[i]; entry; entry = entry->next != cell->table[i] ? entry->next : NULL) {
+            delta = final_delta(entry);
+            if (delta <= delta_limit && (!block || (lowest_delta_mode ?
+                    delta < found_delta || (delta == found_delta && entry->block->bits < block->bits) :
+                    entry->block->bits < block->bits || (entry->block->bits == block->bits && delta < found_delta)))) {
+                block = entry->block;
+                found_delta = delta;
+            }
+        }
+    optimal_delta = found_delta;
+    return block;
+}
+
+long count_entries(CELL *cell) {
+    ENTRY *entry;
+    long count = 0;
+    int i;
+
+    for (i = 0; i < HASH_SIZE; i++)
+        for (entry = cell->table[i]; entry; entry = entry->next != cell->table[i] ? entry->next : NULL)
+            count++;
+    return count;
+}
+
+/* offsets with any match still worth extending */
+int live_offsets(unsigned *live, int max_offset) {
+    unsigned word;
+    int count = 0;
+    int i;
+
+    for (i = 0; i <= max_offset/LIVE_BITS; i++)
+        for (word = live[i]; word; word >>= 1)
+            count += word & 1;
+    return count;
+}
+
+/* entries kept for all offsets with any previous match */
+long live_entries(CELL *last_literal, CELL *last_match, unsigned *live, int max_offset) {
+    unsigned word;
+    long count = 0;
+    int offset;
+    int i;
+
+    for (i = 0; i <= max_offset/LIVE_BITS; i++)
+        for (word = live[i], offset = i*LIVE_BITS; word; word >>= 1, offset++)
+            if (word & 1)
+                count += count_entries(&last_literal[offset]) + count_entries(&last_match[offset]);
+    return count;
+}
+
+void mark_cell(CELL *cell, int permanent) {
+    ENTRY *entry;
+    int i;
+
+    for (i = 0; i < HASH_SIZE; i++)
+        for (entry = cell->table[i]; entry; entry = entry->next != cell->table[i] ? entry->next : NULL) {
+            if (permanent)
+                keep_blocks(entry->block);
+            else
+                mark_blocks(entry->block);
+        }
+}
+
+/* reclaim blocks no longer reachable from any cell, knowing that optimal cells before index never change */
+int collect_blocks(CELL *optimal, CELL *last_literal, CELL *last_match, int kept_index, int index, int max_offset, BLOCK *bound_block) {
+    double start = trace_clock();
+    int i;
+
+    for (i = kept_index; i < index; i++)
+        mark_cell(&optimal[i], TRUE);
+    keep_blocks(bound_block);
+    begin_collection();
+    for (i = 1; i <= max_offset; i++) {
+        mark_cell(&last_literal[i], FALSE);
+        mark_cell(&last_match[i], FALSE);
+    }
+    sweep_blocks();
+    trace_event("collect", start, "\"index\":%d,\"blocks\":%ld", index, allocated_blocks());
+    return index;
+}
+
+BLOCK* optimize(unsigned char *input_data, int input_size, int skip, int offset_limit, int prune_mode, int progress_mode) {
     CELL *last_literal;
     CELL *last_match;
     CELL *optimal;
+    BLOCK *bound_block = NULL;
+    BLOCK *optimal_block = NULL;
+    int *previous;
+    unsigned *live;
+    unsigned word;
+    int *matches;
+    int *literals;
+    int last_position[256];
+    int match_count;
+    int literal_count;
+    int position;
     int index;
     int offset;
     int length;
     int optimal_bits;
+    int live_bits;
+    int kept_index;
+    int window_index;
+    double window_time;
+    double start = trace_clock();
+    int traced = tracing();
+    long visited = 0;
+    long compared = 0;
     int dots = 2;
     int max_offset = offset_ceiling(input_size-1, offset_limit);
+    int i;
+    int j;
 
     /* allocate all main data structures at once */
     last_literal = (CELL *)calloc(max_offset+1, sizeof(CELL));
     last_match = (CELL *)calloc(max_offset+1, sizeof(CELL));
     optimal = (CELL *)calloc(input_size, sizeof(CELL));
-    if (!last_literal || !last_match || !optimal) {
+    previous = (int *)malloc(input_size*sizeof(int));
+    live = (unsigned *)calloc(max_offset/LIVE_BITS+1, sizeof(unsigned));
+    matches = (int *)malloc((max_offset+1)*sizeof(int));
+    literals = (int *)malloc((max_offset+1)*sizeof(int));
+    if (!last_literal || !last_match || !optimal || !previous || !live || !matches || !literals) {
          fprintf(stderr, "Error: Insufficient memory\n");
          exit(1);
     }
 
-    /* start with fake block */
-    add_first_block(&last_match[INITIAL_OFFSET], -1, skip-1, INITIAL_OFFSET, 0);
+    /* link each byte to its previous occurrence, so only matching offsets are visited */
+    for (i = 0; i < 256; i++)
+        last_position[i] = -1;
+    for (i = 0; i < input_size; i++) {
+        previous[i] = last_position[input_data[i]];
+        last_position[input_data[i]] = i;
+    }
+
+    prepare_costs(input_size);
+
+    /* discard any choice that cannot beat a quick estimate */
+    if (prune_mode) {
+        window_time = trace_clock();
+        bound_block = upper_bound_block(input_data, input_size, skip, offset_limit);
+        upper_bound = bound_block->bits;
+        lower_bound = lower_bounds(input_data, input_size, skip, offset_limit);
+        trace_event("prune", window_time, "\"upper_bound\":%d", upper_bound);
+    }
+
+    /* start with fake block, unless resuming from snapshot */
+    index = resume_snapshot(input_data, input_size, skip, offset_limit, optimal, last_literal, last_match);
+    if (index == skip)
+        add_first_block(&last_match[INITIAL_OFFSET], -1, skip-1, INITIAL_OFFSET, 0);
+    for (offset = 1; offset <= offset_ceiling(index, offset_limit); offset++)
+        if (last_match[offset].bits)
+            live[offset/LIVE_BITS] |= 1U << offset%LIVE_BITS;
 
-    printf("[");
+    if (progress_mode)
+        printf("[");
 
     /* process remaining bytes */
-    for (index = skip; index < input_size; index++) {
+    kept_index = skip;
+    window_index = index;
+    window_time = trace_clock();
+    for (; index < input_size; index++) {
         optimal_bits = INT_MAX;
         max_offset = offset_ceiling(index, offset_limit);
-        for (offset = 1; offset <= max_offset; offset++) {
-            if (index != skip && index >= offset && input_data[index] == input_data[index-offset]) {
-                /* copy from last offset */
-                if (last_literal[offset].bits) {
-                    add_last_offset_block(&last_match[offset], index, offset, &last_literal[offset]);
+        if (index != skip && (index-skip) % SNAPSHOT_INTERVAL == 0)
+            save_snapshot(input_data, index, skip, max_offset, optimal, last_literal, last_match);
+        if (collection_due())
+            kept_index = collect_blocks(optimal, last_literal, last_match, kept_index, index, max_offset, bound_block);
+
+        /* visit only offsets matching current byte, nearest first */
+        match_count = 0;
+        for (position = index != skip ? previous[index] : -1; position >= 0 && index-position <= max_offset; position = previous[position]) {
+            offset = index-position;
+            live_bits = last_match[offset].bits;
+            /* copy from last offset */
+            if (last_literal[offset].bits) {
+                add_last_offset_block(&last_match[offset], index, offset, &last_literal[offset]);
+                if (optimal_bits > last_match[offset].bits)
+                    optimal_bits = last_match[offset].bits;
+            }
+            /* copy from another offset, never starting within prefix */
+            for (length = 1; length <= index-offset+1 && length <= index-skip && input_data[index-length+1] == input_data[index-length-offset+1]; length++)
+                if (add_previous_offset_block(&last_match[offset], index, offset, &optimal[index-length]) ||
+                    (length > 1 && add_new_offset_block(&last_match[offset], index, offset, &optimal[index-length])))
                     if (optimal_bits > last_match[offset].bits)
                         optimal_bits = last_match[offset].bits;
-                }
-                /* copy from another offset */
-                for (length = 1; length <= index-offset+1 && input_data[index-length+1] == input_data[index-length-offset+1]; length++)
-                    if (add_previous_offset_block(&last_match[offset], index, offset, &optimal[index-length]) ||
-                        (length > 1 && add_new_offset_block(&last_match[offset], index, offset, &optimal[index-length]))) 
-                        if (optimal_bits > last_match[offset].bits)
-                            optimal_bits = last_match[offset].bits;
-            } else {
-                /* copy literals */
-                if (last_match[offset].bits) {
+            if (traced)
+                compared += length-1;
+            if (!live_bits && last_match[offset].bits)
+                live[offset/LIVE_BITS] |= 1U << offset%LIVE_BITS;
+            matches[match_count++] = offset;
+        }
+
+        /* visit only offsets with any previous match, in ascending order */
+        literal_count = 0;
+        for (i = 0; i <= max_offset/LIVE_BITS; i++)
+            for (word = live[i], offset = i*LIVE_BITS; word; word >>= 1, offset++)
+                if ((word & 1) && !(index != skip && index >= offset && input_data[index] == input_data[index-offset])) {
+                    /* copy literals */
                     add_literal_block(&last_literal[offset], index, &last_match[offset]);
                     if (optimal_bits > last_literal[offset].bits)
                         optimal_bits = last_literal[offset].bits;
+                    literals[literal_count++] = offset;
                 }
-            }
-        }
 
-        /* identify optimal choice so far */
-        for (offset = 1; offset <= max_offset; offset++)
-            if (last_match[offset].bits == optimal_bits && last_match[offset].index == index)
+        /* identify optimal choice so far, merging both visits in ascending offset order */
+        for (i = 0, j = 0; i < match_count || j < literal_count; ) {
+            offset = j == literal_count || (i < match_count && matches[i] < literals[j]) ? matches[i++] : literals[j++];
+            if (delta_mode) {
+                merge_pareto(&optimal[index], &last_match[offset], index);
+                merge_pareto(&optimal[index], &last_literal[offset], index);
+            } else if (last_match[offset].bits == optimal_bits && last_match[offset].index == index)
                 merge_blocks(&optimal[index], &last_match[offset]);
             else if (last_literal[offset].bits == optimal_bits && last_literal[offset].index == index)
                 merge_blocks(&optimal[index], &last_literal[offset]);
+        }
+
+        /* forget offsets extended only by literals once behind by more than a new copy from the same offset costs, since reusing it saves no more */
+        if (!delta_mode)
+            for (j = 0; j < literal_count; j++) {
+                offset = literals[j];
+                if (last_literal[offset].bits > optimal_bits+offset_costs[offset]) {
+                    erase_table(&last_literal[offset]);
+                    erase_table(&last_match[offset]);
+                    last_literal[offset].bits = 0;
+                    last_match[offset].bits = 0;
+                    live[offset/LIVE_BITS] &= ~(1U << offset%LIVE_BITS);
+                }
+            }
+        if (traced)
+            visited += match_count+literal_count;
+
+        /* record work spent on each range of input */
+        if (traced && ((index+1-skip) % TRACE_WINDOW == 0 || index+1 == input_size)) {
+            trace_event("range", window_time, "\"first\":%d,\"last\":%d,\"offsets\":%ld,\"lengths\":%ld", window_index, index, visited, compared);
+            trace_counter("offsets", "\"live\":%d", live_offsets(live, max_offset));
+            trace_counter("entries", "\"live\":%ld,\"allocated\":%ld", live_entries(last_literal, last_match, live, max_offset), allocated_entries());
+            trace_counter("blocks", "\"allocated\":%ld", allocated_blocks());
+            window_index = index+1;
+            window_time = trace_clock();
+            visited = 0;
+            compared = 0;
+        }
 
         /* indicate progress */
-        if (index*MAX_SCALE/input_size > dots) {
+        if (progress_mode && index*MAX_SCALE/input_size > dots) {
             printf(".");
             fflush(stdout);
             dots++;
         }
     }
 
-    printf("]\n");
+    if (progress_mode)
+        printf("]\n");
+
+    optimal_block = delta_mode ? find_delta_block(&optimal[input_size-1]) : find_any_block(&optimal[input_size-1]);
+    finish_snapshot();
+    trace_event("optimize", start, "\"size\":%d,\"skip\":%d,\"bits\":%d", input_size, skip, optimal_block ? optimal_block->bits : -1);
+
+    free(last_literal);
+    free(last_match);
+    free(optimal);
+    free(previous);
+    free(live);
+    free(matches);
+    free(literals);
+
+    /* no choice was better than the estimate itself */
+    if (prune_mode) {
+        if (!optimal_block)
+            optimal_block = bound_block;
+        free(lower_bound);
+        lower_bound = NULL;
+        upper_bound = INT_MAX;
+    }
+
+    return optimal_block;
+}
 
-    return find_any_block(&optimal[input_size-1]);
+/* smallest parse with delta up to limit (if not negative), or with lowest delta, in a single pass */
+BLOCK *optimize_delta(unsigned char *input_data, int input_size, int skip, int offset_limit, int max_delta, int lowest_delta, int *delta) {
+    BLOCK *optimal;
+
+    reset_memory();
+    delta_mode = TRUE;
+    delta_limit = max_delta >= 0 ? max_delta : INT_MAX;
+    lowest_delta_mode = lowest_delta;
+    optimal = optimize(input_data, input_size, skip, offset_limit, FALSE, TRUE);
+    delta_mode = FALSE;
+    *delta = optimal_delta;
+    return optimal;
 }
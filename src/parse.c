@@ -0,0 +1,227 @@
+/*
+ * (c) Copyright 2021 by Einar Saukas. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * The name of its author may not be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "zx5.h"
+
+#define PARSE_HEADER "ZX5 parse"
+
+/* block names in parse files, indexed by block_type() */
+char *block_types[] = { "literal", "last", "2nd", "3rd", "new" };
+
+void append_block(PARSE *parse, int offset, int length) {
+    int *last = parse->count ? parse->blocks+parse->count*2-2 : NULL;
+
+    /* a single byte can only be copied from a repeated offset */
+    if (offset && length == 1 && offset != parse->offset1 && offset != parse->offset2 && offset != parse->offset3)
+        offset = 0;
+
+    /* join literals, or copies from the same offset */
+    if (last && last[0] == offset) {
+        last[1] += length;
+        return;
+    }
+
+    if (parse->count == parse->capacity) {
+        parse->capacity = parse->capacity ? parse->capacity*2 : 1024;
+        parse->blocks = (int *)realloc(parse->blocks, parse->capacity*2*sizeof(int));
+        if (!parse->blocks) {
+            fprintf(stderr, "Error: Insufficient memory\n");
+            exit(1);
+        }
+    }
+    parse->blocks[parse->count*2] = offset;
+    parse->blocks[parse->count*2+1] = length;
+    parse->count++;
+
+    /* track repeated offsets the same way as the compressor */
+    if (offset && offset != parse->offset1) {
+        if (offset != parse->offset2)
+            parse->offset3 = parse->offset2;
+        parse->offset2 = parse->offset1;
+        parse->offset1 = offset;
+    }
+}
+
+/* index in block_types of next block, updating repeated offsets */
+int block_type(int offset, int *offset1, int *offset2, int *offset3) {
+    int type;
+
+    if (!offset)
+        return LITERAL_BLOCK;
+    if (offset == *offset1)
+        return LAST_OFFSET_BLOCK;
+    type = offset == *offset2 ? SECOND_OFFSET_BLOCK : offset == *offset3 ? THIRD_OFFSET_BLOCK : NEW_OFFSET_BLOCK;
+    if (offset != *offset2)
+        *offset3 = *offset2;
+    *offset2 = *offset1;
+    *offset1 = offset;
+    return type;
+}
+
+/* convert sequence of blocks into chain, leaving bits to chain_bits() since joined segments may exceed an int */
+BLOCK *parse_optimal(PARSE *parse) {
+    BLOCK *optimal;
+    int i;
+
+    optimal = allocate_block(-1, INITIAL_OFFSET, 0, NULL);
+    for (i = 0; i < parse->count; i++)
+        optimal = allocate_block(0, parse->blocks[i*2], parse->blocks[i*2+1], optimal);
+    free(parse->blocks);
+    parse->blocks = NULL;
+
+    return optimal;
+}
+
+/* count bits of chain in order (oldest block first), tracking repeated offsets */
+long chain_bits(BLOCK *block) {
+    long bits = -1;
+    int offset1 = INITIAL_OFFSET;
+    int offset2 = 0;
+    int offset3 = 0;
+
+    for (; block; block = block->chain) {
+        switch (block_type(block->offset, &offset1, &offset2, &offset3)) {
+        case LITERAL_BLOCK:
+            bits += 1 + elias_gamma_bits(block->length) + block->length*8L;
+            break;
+        case LAST_OFFSET_BLOCK:
+            bits += 1 + elias_gamma_bits(block->length);
+            break;
+        case SECOND_OFFSET_BLOCK:
+        case THIRD_OFFSET_BLOCK:
+            bits += 3 + elias_gamma_bits(block->length);
+            break;
+        default:
+            bits += 10 + elias_gamma_bits((block->offset-1)/256+1) + elias_gamma_bits(block->length-1);
+        }
+    }
+    return bits;
+}
+
+/* chain is newest first, so collect its blocks in order */
+BLOCK **parse_blocks(BLOCK *optimal, int *count) {
+    BLOCK *block;
+    BLOCK **blocks;
+    int i;
+
+    *count = 0;
+    for (block = optimal; block->chain; block = block->chain)
+        (*count)++;
+    blocks = (BLOCK **)malloc((*count+1)*sizeof(BLOCK *));
+    if (!blocks) {
+        fprintf(stderr, "Error: Insufficient memory\n");
+        exit(1);
+    }
+    i = *count;
+    for (block = optimal; block->chain; block = block->chain)
+        blocks[--i] = block;
+    return blocks;
+}
+
+void write_parse(char *name, BLOCK *optimal, int input_size, int skip, int backwards_mode) {
+    FILE *fp;
+    BLOCK **blocks;
+    int offset1 = INITIAL_OFFSET;
+    int offset2 = 0;
+    int offset3 = 0;
+    int count;
+    int i;
+
+    blocks = parse_blocks(optimal, &count);
+    fp = fopen(name, "w");
+    if (!fp) {
+        fprintf(stderr, "Error: Cannot create parse file %s\n", name);
+        exit(1);
+    }
+    fprintf(fp, "%s %d %d %s\n", PARSE_HEADER, input_size, skip, backwards_mode ? "backwards" : "forward");
+    for (i = 0; i < count; i++)
+        fprintf(fp, "%s %d %d\n", block_types[block_type(blocks[i]->offset, &offset1, &offset2, &offset3)], blocks[i]->offset, blocks[i]->length);
+    if (fclose(fp)) {
+        fprintf(stderr, "Error: Cannot write parse file %s\n", name);
+        exit(1);
+    }
+    free(blocks);
+}
+
+void invalid_parse(char *name, int line) {
+    fprintf(stderr, "Error: Invalid block at line %d of parse file %s\n", line, name);
+    exit(1);
+}
+
+BLOCK *read_parse(char *name, unsigned char *input_data, int input_size, int skip, int offset_limit, int backwards_mode) {
+    PARSE parse = { NULL, 0, 0, INITIAL_OFFSET, 0, 0 };
+    FILE *fp;
+    char type[16];
+    char direction[16];
+    int index = skip;
+    int line = 1;
+    int size;
+    int offset;
+    int length;
+    int i;
+
+    fp = fopen(name, "r");
+    if (!fp) {
+        fprintf(stderr, "Error: Cannot access parse file %s\n", name);
+        exit(1);
+    }
+    if (fscanf(fp, PARSE_HEADER " %d %d %15s", &size, &i, direction) != 3) {
+        fprintf(stderr, "Error: Invalid parse file %s\n", name);
+        exit(1);
+    }
+    if (size != input_size || i != skip || strcmp(direction, backwards_mode ? "backwards" : "forward")) {
+        fprintf(stderr, "Error: Parse file %s does not match input\n", name);
+        exit(1);
+    }
+
+    /* copy types are only informative, since compressor always uses cheapest one */
+    while (fscanf(fp, "%15s %d %d", type, &offset, &length) == 3) {
+        line++;
+        for (i = LITERAL_BLOCK; i <= NEW_OFFSET_BLOCK && strcmp(type, block_types[i]); i++)
+            ;
+        if (i > NEW_OFFSET_BLOCK || (i == LITERAL_BLOCK) != !offset || offset < 0 || offset > offset_limit || length <= 0 || length > input_size-index)
+            invalid_parse(name, line);
+
+        /* first block is always literals, since its indicator bit is never written, and copied bytes must reproduce input */
+        if (offset) {
+            if (index == skip || offset > index)
+                invalid_parse(name, line);
+            for (i = index; i < index+length; i++)
+                if (input_data[i] != input_data[i-offset])
+                    invalid_parse(name, line);
+        }
+        append_block(&parse, offset, length);
+        index += length;
+    }
+    if (!feof(fp) || index != input_size)
+        invalid_parse(name, line+1);
+    fclose(fp);
+
+    return parse_optimal(&parse);
+}
@@ -0,0 +1,180 @@
+/*
+ * (c) Copyright 2021 by Einar Saukas. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * The name of its author may not be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "zx5.h"
+
+int literal_cost(int length) {
+    return 1 + elias_costs[length] + length*8;
+}
+
+int match_cost(int offset, int length, int last_offset1, int last_offset2, int last_offset3, int after_literal) {
+    if (offset == last_offset1)
+        return after_literal ? 1 + elias_costs[length] : -1;
+    if (offset == last_offset2 || offset == last_offset3)
+        return 3 + elias_costs[length];
+    return length > 1 ? offset_costs[offset] + elias_costs[length-1] : -1;
+}
+
+int match_length(unsigned char *input_data, int input_size, int index, int offset) {
+    int length = 0;
+
+    while (index+length < input_size && input_data[index+length] == input_data[index+length-offset])
+        length++;
+    return length;
+}
+
+BLOCK *upper_bound_block(unsigned char *input_data, int input_size, int skip, int offset_limit) {
+    BLOCK *chain;
+    int last_offset1 = INITIAL_OFFSET;
+    int last_offset2 = 0;
+    int last_offset3 = 0;
+    int after_literal = FALSE;
+    int literals = 0;
+    int bits = -1;
+    int index = skip;
+    int offset;
+    int length;
+    int cost;
+    int best_offset;
+    int best_length;
+    int best_cost;
+    int max_offset;
+
+    /* start with fake block, exactly like optimize() */
+    chain = allocate_block(bits, INITIAL_OFFSET, 0, NULL);
+
+    while (index < input_size) {
+        best_length = 0;
+        best_offset = 0;
+        best_cost = 0;
+
+        /* first block is always a literal */
+        if (index > skip || literals) {
+            max_offset = index > offset_limit ? offset_limit : index;
+            for (offset = 1; offset <= max_offset; offset++)
+                if (input_data[index] == input_data[index-offset]) {
+                    length = match_length(input_data, input_size, index, offset);
+                    cost = match_cost(offset, length, last_offset1, last_offset2, last_offset3, after_literal || literals);
+                    if (cost >= 0 && length*8-cost > best_length*8-best_cost) {
+                        best_length = length;
+                        best_offset = offset;
+                        best_cost = cost;
+                    }
+                }
+        }
+
+        if (best_length*8 > best_cost) {
+            if (literals) {
+                bits += literal_cost(literals);
+                chain = allocate_block(bits, 0, literals, chain);
+                literals = 0;
+                after_literal = TRUE;
+            }
+            bits += best_cost;
+            chain = allocate_block(bits, best_offset, best_length, chain);
+            if (best_offset == last_offset2) {
+                last_offset2 = last_offset1;
+            } else if (best_offset != last_offset1) {
+                last_offset3 = last_offset2;
+                last_offset2 = last_offset1;
+            }
+            last_offset1 = best_offset;
+            after_literal = FALSE;
+            index += best_length;
+        } else {
+            literals++;
+            index++;
+        }
+    }
+
+    if (literals) {
+        bits += literal_cost(literals);
+        chain = allocate_block(bits, 0, literals, chain);
+    }
+    return chain;
+}
+
+int *lower_bounds(unsigned char *input_data, int input_size, int skip, int offset_limit) {
+    int *reach;
+    int *bound;
+    int index;
+    int offset;
+    int start;
+    int length;
+    int limit;
+    int bits;
+    int i;
+
+    reach = (int *)malloc((input_size+1)*sizeof(int));
+    bound = (int *)malloc((input_size+1)*sizeof(int));
+    if (!reach || !bound) {
+         fprintf(stderr, "Error: Insufficient memory\n");
+         exit(1);
+    }
+
+    /* for each index, find furthest end of any repetition starting there */
+    for (index = 0; index < input_size; index++)
+        reach[index] = -1;
+    for (offset = 1; offset <= offset_limit && offset < input_size; offset++) {
+        start = -1;
+        for (index = offset > skip ? offset : skip; index < input_size; index++)
+            if (input_data[index] == input_data[index-offset]) {
+                if (start < 0)
+                    start = index;
+            } else if (start >= 0) {
+                if (reach[start] < index-1)
+                    reach[start] = index-1;
+                start = -1;
+            }
+        if (start >= 0 && reach[start] < input_size-1)
+            reach[start] = input_size-1;
+    }
+    for (index = 1; index < input_size; index++)
+        if (reach[index] < reach[index-1])
+            reach[index] = reach[index-1];
+
+    /* minimum cost from each index until the end, assuming the cheapest encoding of every block */
+    bound[input_size] = 0;
+    for (index = input_size-1; index >= skip; index--) {
+        bound[index] = bound[index+1] + 8;
+        limit = reach[index] >= index ? reach[index]-index+1 : 0;
+        for (i = 1; i <= limit; i <<= 1) {
+            length = i*2-1 < limit ? i*2-1 : limit;
+            bits = 1 + elias_costs[length] + bound[index+length];
+            if (bound[index] > bits)
+                bound[index] = bits;
+        }
+    }
+
+    /* shift so that each entry refers to the cost after the last processed index */
+    for (index = skip; index < input_size; index++)
+        bound[index] = bound[index+1];
+
+    free(reach);
+    return bound;
+}
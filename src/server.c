@@ -0,0 +1,127 @@
+/*
+ * (c) Copyright 2021 by Einar Saukas. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * The name of its author may not be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#if defined(__unix__) || defined(__APPLE__)
+#define USE_SOCKETS
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+#include "zx5.h"
+
+#ifdef USE_SOCKETS
+int transfer_data(int fd, void *data, int size, int writing) {
+    ssize_t n;
+
+    while (size > 0) {
+        n = writing ? write(fd, data, size) : read(fd, data, size);
+        if (n <= 0)
+            return FALSE;
+        data = (char *)data+n;
+        size -= n;
+    }
+    return TRUE;
+}
+
+/* connect to server, or create it when listening, returns -1 if failed */
+int open_server(char *name, int listening) {
+    struct sockaddr_un address;
+    int fd;
+
+    if (strlen(name) >= sizeof(address.sun_path))
+        return -1;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, name);
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+    if (listening) {
+        unlink(name);
+        if (!bind(fd, (struct sockaddr *)&address, sizeof(address)) && !listen(fd, SOMAXCONN))
+            return fd;
+    } else if (!connect(fd, (struct sockaddr *)&address, sizeof(address))) {
+        return fd;
+    }
+    close(fd);
+    return -1;
+}
+
+unsigned char *compress_remote(char *server_name, unsigned char *input_data, int input_size, int skip, int flags, int *output_size, int *delta) {
+    unsigned char *output_data;
+    char *message;
+    int request[4];
+    int response[3];
+    int fd;
+
+    fd = open_server(server_name, FALSE);
+    if (fd < 0) {
+        fprintf(stderr, "Error: Cannot connect to server %s\n", server_name);
+        exit(1);
+    }
+
+    /* send request with entire input, then wait for output or error message */
+    request[0] = SERVER_MAGIC;
+    request[1] = flags;
+    request[2] = skip;
+    request[3] = input_size;
+    if (!transfer_data(fd, request, sizeof(request), TRUE) || !transfer_data(fd, input_data, input_size, TRUE) ||
+        !transfer_data(fd, response, sizeof(response), FALSE) || response[1] < 0 || response[1] > MAX_INPUT_SIZE) {
+        fprintf(stderr, "Error: Server %s failed\n", server_name);
+        exit(1);
+    }
+    output_data = (unsigned char *)malloc(response[1]+1);
+    if (!output_data) {
+        fprintf(stderr, "Error: Insufficient memory\n");
+        exit(1);
+    }
+    if (!transfer_data(fd, output_data, response[1], FALSE)) {
+        fprintf(stderr, "Error: Server %s failed\n", server_name);
+        exit(1);
+    }
+    close(fd);
+
+    if (response[0]) {
+        message = (char *)output_data;
+        message[response[1]] = 0;
+        fprintf(stderr, "Error: %s\n", message);
+        exit(1);
+    }
+    *output_size = response[1];
+    *delta = response[2];
+    return output_data;
+}
+#else
+unsigned char *compress_remote(char *server_name, unsigned char *input_data, int input_size, int skip, int flags, int *output_size, int *delta) {
+    fprintf(stderr, "Error: Server not supported on this platform\n");
+    exit(1);
+}
+#endif
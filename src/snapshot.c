@@ -0,0 +1,451 @@
+/*
+ * (c) Copyright 2021 by Einar Saukas. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * The name of its author may not be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "zx5.h"
+
+#define SNAPSHOT_MAGIC 0x535A585AL  /* "ZXZS" */
+#define SNAPSHOT_VERSION 3
+
+char *snapshot_name = NULL;
+FILE *snapshot_file = NULL;
+int snapshot_index;
+
+/* blocks already saved in snapshot, mapped both ways by id */
+BLOCK **saved_blocks = NULL;
+int saved_count = 0;
+int saved_capacity = 0;
+BLOCK **block_table = NULL;
+int *id_table = NULL;
+int table_size = 0;
+
+/* blocks to be saved in next checkpoint, oldest first */
+BLOCK **pending_blocks = NULL;
+int pending_count = 0;
+int pending_capacity = 0;
+
+void *grow_array(void *array, int *capacity, int item_size) {
+    *capacity = *capacity ? *capacity*2 : 1024;
+    array = realloc(array, (size_t)*capacity*item_size);
+    if (!array) {
+        fprintf(stderr, "Error: Insufficient memory\n");
+        exit(1);
+    }
+    return array;
+}
+
+int block_slot(BLOCK *block) {
+    unsigned long hash = (unsigned long)((size_t)block/sizeof(BLOCK));
+    int i;
+
+    /* scramble address, since blocks from separate arenas would otherwise cluster */
+    hash = (hash ^ (hash >> 16)) * 0x45D9F3BUL;
+    hash = (hash ^ (hash >> 16)) * 0x45D9F3BUL;
+    i = (int)((hash ^ (hash >> 16)) & (table_size-1));
+    while (block_table[i] && block_table[i] != block)
+        i = (i+1) & (table_size-1);
+    return i;
+}
+
+void map_block(BLOCK *block, int id) {
+    BLOCK **old_blocks = block_table;
+    int *old_ids = id_table;
+    int old_size = table_size;
+    int i;
+
+    /* keep hash table at most half full */
+    if (saved_count*2 >= table_size) {
+        table_size = table_size ? table_size*2 : 4096;
+        block_table = (BLOCK **)calloc(table_size, sizeof(BLOCK *));
+        id_table = (int *)malloc(table_size*sizeof(int));
+        if (!block_table || !id_table) {
+            fprintf(stderr, "Error: Insufficient memory\n");
+            exit(1);
+        }
+        for (i = 0; i < old_size; i++)
+            if (old_blocks[i]) {
+                block_table[block_slot(old_blocks[i])] = old_blocks[i];
+                id_table[block_slot(old_blocks[i])] = old_ids[i];
+            }
+        free(old_blocks);
+        free(old_ids);
+    }
+    if (saved_count == saved_capacity)
+        saved_blocks = (BLOCK **)grow_array(saved_blocks, &saved_capacity, sizeof(BLOCK *));
+    saved_blocks[saved_count++] = block;
+    i = block_slot(block);
+    block_table[i] = block;
+    id_table[i] = id;
+
+    /* saved blocks must never be recycled, since their address identifies them */
+    keep_blocks(block);
+}
+
+int block_id(BLOCK *block) {
+    BLOCK *next;
+    int first = pending_count;
+    int i;
+
+    if (!block)
+        return -1;
+    if (table_size && block_table[block_slot(block)])
+        return id_table[block_slot(block)];
+
+    /* collect unsaved blocks along chain, then save them oldest first */
+    for (next = block; next && !(table_size && block_table[block_slot(next)]); next = next->chain) {
+        if (pending_count == pending_capacity)
+            pending_blocks = (BLOCK **)grow_array(pending_blocks, &pending_capacity, sizeof(BLOCK *));
+        pending_blocks[pending_count++] = next;
+    }
+    for (i = first; i < (first+pending_count)/2; i++) {
+        next = pending_blocks[i];
+        pending_blocks[i] = pending_blocks[first+pending_count-1-i];
+        pending_blocks[first+pending_count-1-i] = next;
+    }
+    for (i = first; i < pending_count; i++)
+        map_block(pending_blocks[i], saved_count);
+    return saved_count-1;
+}
+
+/* values are never below -1, so they are stored incremented, 7 bits per byte */
+void write_value(int value) {
+    unsigned long data = (unsigned long)value+1;
+
+    for (; data >= 0x80; data >>= 7)
+        putc((int)(data & 0x7F) | 0x80, snapshot_file);
+    if (putc((int)data, snapshot_file) == EOF) {
+        fprintf(stderr, "Error: Cannot write snapshot file %s\n", snapshot_name);
+        exit(1);
+    }
+}
+
+int read_values(FILE *fp, int *values, int count) {
+    unsigned long data;
+    int shift;
+    int c;
+
+    for (; count > 0; count--) {
+        for (data = 0, shift = 0; (c = getc(fp)) != EOF && (c & 0x80) && shift < 28; shift += 7)
+            data |= (unsigned long)(c & 0x7F) << shift;
+        if (c == EOF || (c & 0x80))
+            return FALSE;
+        *values++ = (int)((data | (unsigned long)c << shift)-1);
+    }
+    return TRUE;
+}
+
+/* offsets without any match have empty cells, that are not saved */
+int live_offset(CELL *last_literal, CELL *last_match, int offset) {
+    return last_literal[offset].bits || last_match[offset].bits;
+}
+
+/* number of values to save cell, assigning ids to its blocks */
+int cell_size(CELL *cell) {
+    ENTRY *entry;
+    int size = 1;
+    int i;
+
+    if (cell->bits) {
+        size += 2;
+        for (i = 0; i < HASH_SIZE; i++)
+            for (entry = cell->table[i]; entry; entry = entry->next != cell->table[i] ? entry->next : NULL) {
+                block_id(entry->block);
+                size += 4;
+            }
+    }
+    return size;
+}
+
+/* entries are saved in table order, since their hash already identifies where they belong */
+void write_cell(CELL *cell) {
+    ENTRY *entry;
+    int i;
+
+    write_value(cell->bits);
+    if (cell->bits) {
+        write_value(cell->index);
+        write_value((int)count_entries(cell));
+        for (i = 0; i < HASH_SIZE; i++)
+            for (entry = cell->table[i]; entry; entry = entry->next != cell->table[i] ? entry->next : NULL) {
+                write_value(entry->offset1);
+                write_value(entry->offset2);
+                write_value(entry->offset3);
+                write_value(block_id(entry->block));
+            }
+    }
+}
+
+/* rebuild cell from saved values, keeping entries in same order */
+int *load_cell(CELL *cell, int *values) {
+    ENTRY *last[HASH_SIZE];
+    ENTRY *entry;
+    int count;
+    int i;
+
+    cell->bits = *values++;
+    if (cell->bits) {
+        cell->index = *values++;
+        for (i = 0; i < HASH_SIZE; i++)
+            last[i] = NULL;
+        for (count = *values++; count > 0; count--, values += 4) {
+            i = hash(values[0], values[1], values[2]);
+            entry = allocate_entry(values[0], values[1], values[2]);
+            entry->block = values[3] >= 0 ? saved_blocks[values[3]] : NULL;
+            if (last[i]) {
+                entry->next = last[i]->next;
+                last[i]->next = entry;
+            } else {
+                entry->next = entry;
+                cell->table[i] = entry;
+            }
+            last[i] = entry;
+        }
+    }
+    return values;
+}
+
+void use_snapshot(char *name) {
+    snapshot_name = name;
+}
+
+void invalid_snapshot() {
+    fprintf(stderr, "Error: Invalid snapshot file %s\n", snapshot_name);
+    exit(1);
+}
+
+int *read_section(FILE *fp, int *values, int *size) {
+    if (!read_values(fp, size, 1) || *size < 0)
+        invalid_snapshot();
+    values = (int *)realloc(values, (*size+1)*sizeof(int));
+    if (!values) {
+        fprintf(stderr, "Error: Insufficient memory\n");
+        exit(1);
+    }
+    if (!read_values(fp, values, *size))
+        invalid_snapshot();
+    return values;
+}
+
+/* resume from last saved checkpoint that matches input, returns index to continue from */
+int resume_snapshot(unsigned char *input_data, int input_size, int skip, int offset_limit, CELL *optimal, CELL *last_literal, CELL *last_match) {
+    FILE *fp;
+    char *output_name;
+    unsigned char *chunk = NULL;
+    int *values = NULL;
+    int *last_values = NULL;
+    int *next;
+    BLOCK *chain;
+    int header[4];
+    int block[4];
+    int live_count = 0;
+    long position = 0;
+    int first;
+    int size;
+    int offset;
+    int count;
+    int c;
+
+    if (!snapshot_name)
+        return skip;
+    snapshot_index = skip;
+
+    /* load checkpoints from previous snapshot while input is still the same */
+    fp = fopen(snapshot_name, "rb");
+    if (fp && read_values(fp, header, 4) && header[0] == SNAPSHOT_MAGIC && header[1] == SNAPSHOT_VERSION && header[2] == skip && header[3] == offset_limit) {
+        position = ftell(fp);
+        while (read_values(fp, header, 2) && header[1] == snapshot_index && header[0] > snapshot_index && header[0] < input_size) {
+            first = snapshot_index == skip ? 0 : snapshot_index;
+            chunk = (unsigned char *)realloc(chunk, header[0]-first);
+            if (!chunk) {
+                fprintf(stderr, "Error: Insufficient memory\n");
+                exit(1);
+            }
+            if (fread(chunk, sizeof(char), header[0]-first, fp) != (size_t)(header[0]-first) || memcmp(chunk, input_data+first, header[0]-first))
+                break;
+            if (!read_values(fp, &count, 1))
+                invalid_snapshot();
+            while (count-- > 0) {
+                if (!read_values(fp, block, 4) || block[3] < 0 || block[3] > saved_count)
+                    invalid_snapshot();
+                chain = block[3] ? saved_blocks[saved_count-block[3]] : NULL;
+                map_block(allocate_block(block[0]+(chain ? chain->bits : 0), block[1], block[2], chain), saved_count);
+            }
+            values = read_section(fp, values, &size);
+            for (next = values; snapshot_index < header[0]; snapshot_index++)
+                next = load_cell(&optimal[snapshot_index], next);
+            if (!read_values(fp, &live_count, 1))
+                invalid_snapshot();
+            last_values = read_section(fp, last_values, &size);
+            position = ftell(fp);
+        }
+
+        /* only cells of last checkpoint are still current */
+        for (next = last_values; next && live_count > 0; live_count--) {
+            offset = *next++;
+            next = load_cell(&last_literal[offset], next);
+            next = load_cell(&last_match[offset], next);
+        }
+    }
+
+    /* new snapshot starts with same checkpoints, and replaces previous one when finished */
+    output_name = (char *)malloc(strlen(snapshot_name)+5);
+    if (!output_name) {
+        fprintf(stderr, "Error: Insufficient memory\n");
+        exit(1);
+    }
+    strcpy(output_name, snapshot_name);
+    strcat(output_name, ".tmp");
+    snapshot_file = fopen(output_name, "wb");
+    free(output_name);
+    if (!snapshot_file) {
+        fprintf(stderr, "Error: Cannot create snapshot file %s\n", snapshot_name);
+        exit(1);
+    }
+    if (position) {
+        fseek(fp, 0L, SEEK_SET);
+        while (position-- > 0 && (c = getc(fp)) != EOF)
+            putc(c, snapshot_file);
+    } else {
+        write_value(SNAPSHOT_MAGIC);
+        write_value(SNAPSHOT_VERSION);
+        write_value(skip);
+        write_value(offset_limit);
+    }
+    if (fp)
+        fclose(fp);
+
+    free(chunk);
+    free(values);
+    free(last_values);
+    return snapshot_index;
+}
+
+/* first index whose optimal cell a later copy may still start from, since copies can only extend matches running up to index */
+int first_reachable(unsigned char *input_data, int index, int skip, int max_offset) {
+    int first = index-1;
+    int offset;
+    int i;
+
+    for (offset = 1; offset <= max_offset && first > skip; offset++) {
+        for (i = index-1; i >= offset && i >= skip && input_data[i] == input_data[i-offset]; i--)
+            ;
+        if (first > i)
+            first = i;
+    }
+    return first > skip ? first : skip;
+}
+
+/* save checkpoint with all cells that may still be used after index */
+void save_snapshot(unsigned char *input_data, int index, int skip, int max_offset, CELL *optimal, CELL *last_literal, CELL *last_match) {
+    int first = snapshot_index == skip ? 0 : snapshot_index;
+    int reachable = first_reachable(input_data, index, skip, max_offset);
+    int optimal_size = 0;
+    int last_size = 0;
+    int live_count = 0;
+    int offset;
+    int i;
+
+    if (!snapshot_file)
+        return;
+
+    /* identify blocks not saved yet */
+    pending_count = 0;
+    for (i = snapshot_index; i < index; i++)
+        optimal_size += i < reachable ? 1 : cell_size(&optimal[i]);
+    for (offset = 1; offset <= max_offset; offset++)
+        if (live_offset(last_literal, last_match, offset)) {
+            last_size += 1+cell_size(&last_literal[offset])+cell_size(&last_match[offset]);
+            live_count++;
+        }
+
+    write_value(index);
+    write_value(snapshot_index);
+    if (fwrite(input_data+first, sizeof(char), index-first, snapshot_file) != (size_t)(index-first)) {
+        fprintf(stderr, "Error: Cannot write snapshot file %s\n", snapshot_name);
+        exit(1);
+    }
+    /* each block refers to its chain relative to itself, usually just saved before, and only adds its own bits */
+    write_value(pending_count);
+    for (i = 0; i < pending_count; i++) {
+        write_value(pending_blocks[i]->bits-(pending_blocks[i]->chain ? pending_blocks[i]->chain->bits : 0));
+        write_value(pending_blocks[i]->offset);
+        write_value(pending_blocks[i]->length);
+        write_value(pending_blocks[i]->chain ? block_id(pending_blocks[i])-block_id(pending_blocks[i]->chain) : 0);
+    }
+    write_value(optimal_size);
+    for (i = snapshot_index; i < index; i++)
+        if (i < reachable)
+            write_value(0);
+        else
+            write_cell(&optimal[i]);
+    write_value(live_count);
+    write_value(last_size);
+    for (offset = 1; offset <= max_offset; offset++)
+        if (live_offset(last_literal, last_match, offset)) {
+            write_value(offset);
+            write_cell(&last_literal[offset]);
+            write_cell(&last_match[offset]);
+        }
+    snapshot_index = index;
+}
+
+void finish_snapshot() {
+    char *output_name;
+
+    if (!snapshot_file)
+        return;
+    fclose(snapshot_file);
+    snapshot_file = NULL;
+
+    output_name = (char *)malloc(strlen(snapshot_name)+5);
+    if (!output_name) {
+        fprintf(stderr, "Error: Insufficient memory\n");
+        exit(1);
+    }
+    strcpy(output_name, snapshot_name);
+    strcat(output_name, ".tmp");
+    remove(snapshot_name);
+    if (rename(output_name, snapshot_name)) {
+        fprintf(stderr, "Error: Cannot create snapshot file %s\n", snapshot_name);
+        exit(1);
+    }
+    free(output_name);
+
+    /* saved blocks are released by reset_memory() */
+    free(saved_blocks);
+    free(block_table);
+    free(id_table);
+    free(pending_blocks);
+    saved_blocks = NULL;
+    block_table = NULL;
+    id_table = NULL;
+    pending_blocks = NULL;
+    saved_count = saved_capacity = table_size = 0;
+    pending_count = pending_capacity = 0;
+    snapshot_name = NULL;
+}
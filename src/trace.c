@@ -0,0 +1,87 @@
+/*
+ * ZX5 tracing - by Einar Saukas
+ * https://github.com/einar-saukas/ZX5
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+
+#include "trace.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/time.h>
+#else
+#include <time.h>
+#endif
+
+#define FALSE 0
+#define TRUE 1
+
+FILE *trace_file = NULL;
+double trace_origin;
+
+/* current time in microseconds */
+double trace_clock() {
+#if defined(__unix__) || defined(__APPLE__)
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+    return now.tv_sec*1e6+now.tv_usec;
+#else
+    return (double)clock()*1e6/CLOCKS_PER_SEC;
+#endif
+}
+
+int trace_open(char *name, char *process_name) {
+    trace_file = fopen(name, "w");
+    if (!trace_file)
+        return FALSE;
+    trace_origin = trace_clock();
+    fprintf(trace_file, "{\"traceEvents\":[\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"%s\"}}", process_name);
+    return TRUE;
+}
+
+int tracing() {
+    return trace_file != NULL;
+}
+
+/* complete event from start until now */
+void trace_event(char *name, double start, char *format, ...) {
+    va_list args;
+
+    if (!trace_file)
+        return;
+    fprintf(trace_file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%.0f,\"dur\":%.0f,\"args\":{",
+            name, start-trace_origin, trace_clock()-start);
+    va_start(args, format);
+    vfprintf(trace_file, format, args);
+    va_end(args);
+    fprintf(trace_file, "}}");
+}
+
+/* counter values at this moment */
+void trace_counter(char *name, char *format, ...) {
+    va_list args;
+
+    if (!trace_file)
+        return;
+    fprintf(trace_file, ",\n{\"name\":\"%s\",\"ph\":\"C\",\"pid\":1,\"tid\":1,\"ts\":%.0f,\"args\":{", name, trace_clock()-trace_origin);
+    va_start(args, format);
+    vfprintf(trace_file, format, args);
+    va_end(args);
+    fprintf(trace_file, "}}");
+}
+
+int trace_close() {
+    FILE *fp = trace_file;
+
+    if (!fp)
+        return TRUE;
+    trace_file = NULL;
+    fprintf(fp, "\n]}\n");
+    if (ferror(fp)) {
+        fclose(fp);
+        return FALSE;
+    }
+    return !fclose(fp);
+}
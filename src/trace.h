@@ -0,0 +1,29 @@
+/*
+ * ZX5 tracing - by Einar Saukas
+ * https://github.com/einar-saukas/ZX5
+ */
+
+/*
+ * Optional timeline in Chrome trace event format, that can be loaded by
+ * chrome://tracing or https://ui.perfetto.dev to see where time is spent.
+ * Each event covers a phase, or a range of data processed within a phase,
+ * with its own counters as arguments formatted as JSON object members.
+ * All functions do nothing unless trace_open() succeeded.
+ */
+
+#ifndef ZX5_TRACE_H
+#define ZX5_TRACE_H
+
+int trace_open(char *name, char *process_name);
+
+int tracing();
+
+double trace_clock();
+
+void trace_event(char *name, double start, char *format, ...);
+
+void trace_counter(char *name, char *format, ...);
+
+int trace_close();
+
+#endif
@@ -0,0 +1,181 @@
+/*
+ * (c) Copyright 2021 by Einar Saukas. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * The name of its author may not be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#if defined(__unix__) || defined(__APPLE__)
+#define USE_PROCESSES
+#include <unistd.h>
+#include <sys/wait.h>
+#endif
+
+#include "zx5.h"
+
+#define MAX_SCALE 55
+#define MAX_PROCESSES 64
+
+int *optimize_segment(unsigned char *input_data, int start, int end, int offset_limit, int prune_mode, int *count) {
+    BLOCK *optimal;
+    BLOCK *block;
+    int base = start > offset_limit ? start-offset_limit : 0;
+    int *blocks;
+    int i;
+
+    /* previous bytes within offset limit are only used as dictionary */
+    optimal = optimize(input_data+base, end-base, start-base, offset_limit, prune_mode, FALSE);
+    if (!optimal) {
+        fprintf(stderr, "Error: Cannot optimize segment\n");
+        exit(1);
+    }
+
+    *count = 0;
+    for (block = optimal; block->chain; block = block->chain)
+        (*count)++;
+    blocks = (int *)malloc((*count*2+1)*sizeof(int));
+    if (!blocks) {
+        fprintf(stderr, "Error: Insufficient memory\n");
+        exit(1);
+    }
+    i = *count*2;
+    for (block = optimal; block->chain; block = block->chain) {
+        blocks[--i] = block->length;
+        blocks[--i] = block->offset;
+    }
+
+    /* release all blocks and entries at once */
+    reset_memory();
+
+    return blocks;
+}
+
+#ifdef USE_PROCESSES
+int start_segment(unsigned char *input_data, int start, int end, int offset_limit, int prune_mode, pid_t *pid, int *fd) {
+    int pipe_fds[2];
+    int *blocks;
+    int count;
+
+    if (pipe(pipe_fds))
+        return FALSE;
+    fflush(stdout);
+    *pid = fork();
+    if (*pid < 0) {
+        close(pipe_fds[0]);
+        close(pipe_fds[1]);
+        return FALSE;
+    }
+    if (!*pid) {
+        close(pipe_fds[0]);
+        blocks = optimize_segment(input_data, start, end, offset_limit, prune_mode, &count);
+        _exit(transfer_data(pipe_fds[1], &count, sizeof(int), TRUE) && transfer_data(pipe_fds[1], blocks, count*2*sizeof(int), TRUE) ? 0 : 1);
+    }
+    close(pipe_fds[1]);
+    *fd = pipe_fds[0];
+    return TRUE;
+}
+
+int *finish_segment(pid_t pid, int fd, int *count) {
+    int *blocks = NULL;
+    int status;
+    int success;
+
+    success = transfer_data(fd, count, sizeof(int), FALSE) && *count >= 0 &&
+              (blocks = (int *)malloc((*count*2+1)*sizeof(int))) != NULL &&
+              transfer_data(fd, blocks, *count*2*sizeof(int), FALSE);
+    close(fd);
+    if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) || !success) {
+        fprintf(stderr, "Error: Cannot optimize segment\n");
+        exit(1);
+    }
+    return blocks;
+}
+#endif
+
+/* number of segments optimized at once, all available processors unless specified otherwise */
+int segment_processes(int processes, int segments) {
+#ifdef USE_PROCESSES
+    if (processes <= 0)
+        processes = sysconf(_SC_NPROCESSORS_ONLN);
+    if (processes > MAX_PROCESSES)
+        processes = MAX_PROCESSES;
+    return processes < segments ? processes > 0 ? processes : 1 : segments;
+#else
+    return 1;
+#endif
+}
+
+BLOCK *optimize_windowed(unsigned char *input_data, int input_size, int skip, int offset_limit, int prune_mode, int processes) {
+#ifdef USE_PROCESSES
+    pid_t pids[MAX_PROCESSES];
+    int fds[MAX_PROCESSES];
+#endif
+    PARSE parse = { NULL, 0, 0, INITIAL_OFFSET, 0, 0 };
+    int segment_size = offset_limit*SEGMENT_SCALE;
+    int segments = (input_size-skip+segment_size-1)/segment_size;
+    int launched = 0;
+    int done;
+    int start;
+    int *blocks;
+    int count;
+    int dots = 0;
+    int i;
+
+    processes = segment_processes(processes, segments);
+
+    printf("[");
+
+    /* optimize each segment separately, then join them in order (each one starts from initial offset instead of last offsets of previous one, still unknown) */
+    for (done = 0; done < segments; done++) {
+#ifdef USE_PROCESSES
+        for (; launched < segments && launched-done < processes; launched++) {
+            start = skip+launched*segment_size;
+            if (!start_segment(input_data, start, start+segment_size < input_size ? start+segment_size : input_size, offset_limit, prune_mode,
+                               &pids[launched%MAX_PROCESSES], &fds[launched%MAX_PROCESSES]))
+                break;
+        }
+        if (launched > done) {
+            blocks = finish_segment(pids[done%MAX_PROCESSES], fds[done%MAX_PROCESSES], &count);
+        } else
+#endif
+        {
+            start = skip+done*segment_size;
+            blocks = optimize_segment(input_data, start, start+segment_size < input_size ? start+segment_size : input_size, offset_limit, prune_mode, &count);
+            launched = done+1;
+        }
+        for (i = 0; i < count; i++)
+            append_block(&parse, blocks[i*2], blocks[i*2+1]);
+        free(blocks);
+
+        /* indicate progress */
+        while ((done+1)*MAX_SCALE/segments > dots) {
+            printf(".");
+            fflush(stdout);
+            dots++;
+        }
+    }
+
+    printf("]\n");
+
+    return parse_optimal(&parse);
+}
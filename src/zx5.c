@@ -26,11 +26,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 
 #include "zx5.h"
-
-#define MAX_OFFSET_ZX5    65280
-#define MAX_OFFSET_ZX7     2176
+#include "trace.h"
 
 void reverse(unsigned char *first, unsigned char *last) {
     unsigned char c;
@@ -42,22 +41,47 @@ void reverse(unsigned char *first, unsigned char *last) {
     }
 }
 
+void close_trace(char *name) {
+    if (!trace_close()) {
+        fprintf(stderr, "Error: Cannot write trace file %s\n", name);
+        exit(1);
+    }
+}
+
 int main(int argc, char *argv[]) {
     int skip = 0;
     int forced_mode = FALSE;
     int quick_mode = FALSE;
+    int prune_mode = FALSE;
+    int windowed_mode = FALSE;
+    int processes = 0;
+    int dry_run_mode = FALSE;
+    int minimize_delta_mode = FALSE;
+    int fast_decoder_mode = FALSE;
+    int max_delta = -1;
     int backwards_mode = FALSE;
     int classic_mode = FALSE;
     char *output_name;
+    char *snapshot_name = NULL;
+    char *emit_parse_name = NULL;
+    char *from_parse_name = NULL;
+    char *decoder_name = NULL;
+    char *trace_name = NULL;
+    char *server_name = NULL;
+    BLOCK *optimal;
     unsigned char *input_data;
     unsigned char *output_data;
     FILE *ifp;
     FILE *ofp;
+    long file_size;
     int input_size;
     int output_size;
     int partial_counter;
     int total_counter;
+    int offset_limit;
     int delta;
+    int smaller_delta;
+    double start;
     int i;
 
     printf("ZX5 v2.0: Experimental data compressor by Einar Saukas\n");
@@ -72,12 +96,75 @@ int main(int argc, char *argv[]) {
             backwards_mode = TRUE;
         } else if (!strcmp(argv[i], "-q")) {
             quick_mode = TRUE;
+        } else if (!strcmp(argv[i], "-p")) {
+            prune_mode = TRUE;
+        } else if (!strcmp(argv[i], "-w")) {
+            windowed_mode = TRUE;
+        } else if (!strncmp(argv[i], "-j", 2) && (processes = atoi(argv[i]+2)) > 0) {
+            windowed_mode = TRUE;
+        } else if (!strcmp(argv[i], "--dry-run")) {
+            dry_run_mode = TRUE;
+        } else if (!strcmp(argv[i], "--max-delta") && i+1 < argc && (max_delta = atoi(argv[i+1])) >= 0 && *argv[i+1] >= '0' && *argv[i+1] <= '9') {
+            i++;
+        } else if (!strcmp(argv[i], "--snapshot") && i+1 < argc) {
+            snapshot_name = argv[++i];
+        } else if (!strcmp(argv[i], "--emit-parse") && i+1 < argc) {
+            emit_parse_name = argv[++i];
+        } else if (!strcmp(argv[i], "--from-parse") && i+1 < argc) {
+            from_parse_name = argv[++i];
+        } else if (!strcmp(argv[i], "--emit-decoder") && i+1 < argc) {
+            decoder_name = argv[++i];
+        } else if (!strcmp(argv[i], "--emit-fast-decoder") && i+1 < argc) {
+            decoder_name = argv[++i];
+            fast_decoder_mode = TRUE;
+        } else if (!strcmp(argv[i], "--trace") && i+1 < argc) {
+            trace_name = argv[++i];
+        } else if (!strcmp(argv[i], "--server") && i+1 < argc) {
+            server_name = argv[++i];
+        } else if (!strcmp(argv[i], "--minimize-delta")) {
+            minimize_delta_mode = TRUE;
         } else if ((skip = atoi(argv[i])) <= 0) {
             fprintf(stderr, "Error: Invalid parameter %s\n", argv[i]);
             exit(1);
         }
     }
 
+    /* delta options require optimizing entire input at once */
+    if (windowed_mode && (max_delta >= 0 || minimize_delta_mode)) {
+        fprintf(stderr, "Error: Cannot limit delta in windowed compression\n");
+        exit(1);
+    }
+
+    /* snapshot must not depend on input beyond each checkpoint */
+    if (snapshot_name && (windowed_mode || prune_mode)) {
+        fprintf(stderr, "Error: Cannot use snapshot with pruning or windowed compression\n");
+        exit(1);
+    }
+
+    /* parse file replaces optimization entirely */
+    if (from_parse_name && (windowed_mode || prune_mode || snapshot_name || max_delta >= 0 || minimize_delta_mode)) {
+        fprintf(stderr, "Error: Cannot combine parse file with optimization options\n");
+        exit(1);
+    }
+
+    /* server only compresses input as a whole */
+    if (server_name && (windowed_mode || snapshot_name || emit_parse_name || from_parse_name || decoder_name || max_delta >= 0 || minimize_delta_mode)) {
+        fprintf(stderr, "Error: Cannot use server with windowed, snapshot, parse, decoder or delta options\n");
+        exit(1);
+    }
+
+    /* trace only covers compression within this process */
+    if (trace_name && (windowed_mode || server_name)) {
+        fprintf(stderr, "Error: Cannot trace windowed or server compression\n");
+        exit(1);
+    }
+
+    /* decoders are derived from standard versions only */
+    if (decoder_name && classic_mode) {
+        fprintf(stderr, "Error: Cannot generate decoder for classic file format\n");
+        exit(1);
+    }
+
     /* determine output filename */
     if (argc == i+1) {
         output_name = (char *)malloc(strlen(argv[i])+5);
@@ -86,11 +173,24 @@ int main(int argc, char *argv[]) {
     } else if (argc == i+2) {
         output_name = argv[i+1];
     } else {
-        fprintf(stderr, "Usage: %s [-f] [-c] [-b] [-q] input [output.zx5]\n"
+        fprintf(stderr, "Usage: %s [-f] [-c] [-b] [-q] [-p] [-w] [-jN] [--dry-run] [--max-delta N] [--minimize-delta] [--snapshot FILE] [--emit-parse FILE] [--from-parse FILE] [--emit-decoder FILE] [--emit-fast-decoder FILE] [--trace FILE] [--server SOCKET] input [output.zx5]\n"
                         "  -f      Force overwrite of output file\n"
                         "  -c      Classic file format (v1.*)\n"
                         "  -b      Compress backwards\n"
-                        "  -q      Quick non-optimal compression\n", argv[0]);
+                        "  -q      Quick non-optimal compression\n"
+                        "  -p      Prune choices that cannot beat a quick estimate\n"
+                        "  -w      Windowed compression in parallel segments (for large files)\n"
+                        "  -jN     Windowed compression using N processes (implies -w)\n"
+                        "  --dry-run  Estimate time and memory without compressing\n"
+                        "  --max-delta N  Smallest compression with delta up to N\n"
+                        "  --minimize-delta  Smallest compression with lowest possible delta\n"
+                        "  --snapshot FILE  Resume from (and update) optimization snapshot\n"
+                        "  --emit-parse FILE  Save optimal parse to file\n"
+                        "  --from-parse FILE  Compress using parse from file instead of optimizing\n"
+                        "  --emit-decoder FILE  Save Z80 decoder specialized for output file\n"
+                        "  --emit-fast-decoder FILE  Same, unrolling common paths for speed at the cost of size\n"
+                        "  --trace FILE  Save timeline of compression phases in Chrome trace format\n"
+                        "  --server SOCKET  Compress using daemon zx5d listening on socket\n", argv[0]);
         exit(1);
     }
 
@@ -102,12 +202,21 @@ int main(int argc, char *argv[]) {
     }
     /* determine input size */
     fseek(ifp, 0L, SEEK_END);
-    input_size = ftell(ifp);
+    file_size = ftell(ifp);
     fseek(ifp, 0L, SEEK_SET);
-    if (!input_size) {
+    if (file_size < 0) {
+        fprintf(stderr, "Error: Cannot access input file %s\n", argv[i]);
+        exit(1);
+    }
+    if (!file_size) {
         fprintf(stderr, "Error: Empty input file %s\n", argv[i]);
         exit(1);
     }
+    if (file_size > (windowed_mode ? MAX_WINDOWED_SIZE : MAX_INPUT_SIZE)) {
+        fprintf(stderr, "Error: Input file %s too large\n", argv[i]);
+        exit(1);
+    }
+    input_size = (int)file_size;
 
     /* validate skip against input size */
     if (skip >= input_size) {
@@ -122,6 +231,13 @@ int main(int argc, char *argv[]) {
         exit(1);
     }
 
+    /* start timeline before reading input */
+    if (trace_name && !trace_open(trace_name, "zx5")) {
+        fprintf(stderr, "Error: Cannot create trace file %s\n", trace_name);
+        exit(1);
+    }
+    start = trace_clock();
+
     /* read input file */
     total_counter = 0;
     do {
@@ -136,6 +252,17 @@ int main(int argc, char *argv[]) {
 
     /* close input file */
     fclose(ifp);
+    trace_event("read", start, "\"size\":%d", input_size);
+
+    /* estimate resources instead of compressing */
+    if (dry_run_mode) {
+        if (backwards_mode)
+            reverse(input_data, input_data+input_size-1);
+        forecast(input_data, input_size, skip, MAX_OFFSET_ZX5, prune_mode, windowed_mode, processes, "full");
+        forecast(input_data, input_size, skip, MAX_OFFSET_ZX7, prune_mode, windowed_mode, processes, "quick");
+        close_trace(trace_name);
+        return 0;
+    }
 
     /* check output file */
     if (!forced_mode && fopen(output_name, "rb") != NULL) {
@@ -154,14 +281,62 @@ int main(int argc, char *argv[]) {
     if (backwards_mode)
         reverse(input_data, input_data+input_size-1);
 
-    /* generate output file */
-    output_data = compress(optimize(input_data, input_size, skip, quick_mode ? MAX_OFFSET_ZX7 : MAX_OFFSET_ZX5), input_data, input_size, skip, backwards_mode, !classic_mode && !backwards_mode, &output_size, &delta);
+    /* generate output file, unless compressed by server */
+    offset_limit = quick_mode ? MAX_OFFSET_ZX7 : MAX_OFFSET_ZX5;
+    if (server_name) {
+        output_data = compress_remote(server_name, input_data, input_size, skip, (quick_mode ? SERVER_QUICK : 0) | (backwards_mode ? SERVER_BACKWARDS : 0) |
+                                      (classic_mode ? SERVER_CLASSIC : 0) | (prune_mode ? SERVER_PRUNE : 0), &output_size, &delta);
+    } else {
+        use_snapshot(snapshot_name);
+        if (from_parse_name)
+            optimal = read_parse(from_parse_name, input_data, input_size, skip, MAX_OFFSET_ZX5, backwards_mode);
+        else if (windowed_mode)
+            optimal = optimize_windowed(input_data, input_size, skip, offset_limit, prune_mode, processes);
+        else
+            optimal = optimize(input_data, input_size, skip, offset_limit, prune_mode, TRUE);
+        if (emit_parse_name)
+            write_parse(emit_parse_name, optimal, input_size, skip, backwards_mode);
+        if (decoder_name)
+            write_decoder(decoder_name, optimal, backwards_mode, fast_decoder_mode);
+        output_data = compress(optimal, input_data, input_size, skip, backwards_mode, !classic_mode && !backwards_mode, &output_size, &delta);
+
+        /* release all blocks and entries at once */
+        reset_memory();
+    }
+
+    /* conditionally recompress within delta limit, or with lowest possible delta (end marker alone requires 2) */
+    if ((max_delta >= 0 && delta > max_delta) || (minimize_delta_mode && delta > 2)) {
+        optimal = optimize_delta(input_data, input_size, skip, offset_limit, max_delta, minimize_delta_mode, &smaller_delta);
+
+        /* keep previous result unless this one is within limit, and better */
+        if (optimal && (max_delta < 0 || smaller_delta <= max_delta) &&
+            (smaller_delta < delta || (smaller_delta == delta && (optimal->bits+27)/8 < output_size))) {
+            if (emit_parse_name)
+                write_parse(emit_parse_name, optimal, input_size, skip, backwards_mode);
+            if (decoder_name)
+                write_decoder(decoder_name, optimal, backwards_mode, fast_decoder_mode);
+            free(output_data);
+            output_data = compress(optimal, input_data, input_size, skip, backwards_mode, !classic_mode && !backwards_mode, &output_size, &delta);
+        }
+        reset_memory();
+        if (max_delta >= 0 && delta > max_delta) {
+            fclose(ofp);
+            remove(output_name);
+            if (emit_parse_name)
+                remove(emit_parse_name);
+            if (decoder_name)
+                remove(decoder_name);
+            fprintf(stderr, "Error: Cannot find compression with delta %d\n", max_delta);
+            exit(1);
+        }
+    }
 
     /* conditionally reverse output file */
     if (backwards_mode)
         reverse(output_data, output_data+output_size-1);
 
     /* write output file */
+    start = trace_clock();
     if (fwrite(output_data, sizeof(char), output_size, ofp) != output_size) {
         fprintf(stderr, "Error: Cannot write output file %s\n", output_name);
         exit(1);
@@ -169,6 +344,8 @@ int main(int argc, char *argv[]) {
 
     /* close output file */
     fclose(ofp);
+    trace_event("write", start, "\"size\":%d", output_size);
+    close_trace(trace_name);
 
     /* done! */
     printf("File%s compressed%s from %d to %d bytes! (delta %d)\n", (skip ? " partially" : ""), (backwards_mode ? " backwards" : ""), input_size-skip, output_size, delta);
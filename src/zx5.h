@@ -25,17 +25,44 @@
 
 #define INITIAL_OFFSET 1
 
+#define MAX_OFFSET_ZX5    65280
+#define MAX_OFFSET_ZX7     2176
+
+/* bit count of incompressible input must fit in an int, or in a long when optimized in segments (keeping output size in an int) */
+#define MAX_INPUT_SIZE    (INT_MAX/9)
+#define MAX_WINDOWED_SIZE (LONG_MAX/9 < INT_MAX/9*8 ? LONG_MAX/9 : INT_MAX/9*8)
+
 #define FALSE 0
 #define TRUE 1
 
 #define HASH_SIZE 16
 
+/* windowed compression optimizes segments of this many times the offset limit */
+#define SEGMENT_SCALE 4
+
+/* blocks allocated before first collection */
+#define COLLECT_MINIMUM (1L << 20)
+
+/* block types returned by block_type() */
+#define LITERAL_BLOCK 0
+#define LAST_OFFSET_BLOCK 1
+#define SECOND_OFFSET_BLOCK 2
+#define THIRD_OFFSET_BLOCK 3
+#define NEW_OFFSET_BLOCK 4
+
+/* compression daemon protocol */
+#define SERVER_MAGIC 0x445A585AL  /* "ZXZD" */
+#define SERVER_QUICK 1
+#define SERVER_BACKWARDS 2
+#define SERVER_CLASSIC 4
+#define SERVER_PRUNE 8
+
 typedef struct block_t {
     struct block_t *chain;
     int bits;
     int offset;
     int length;
-    int references;
+    int generation;
 } BLOCK;
 
 typedef struct entry_t {
@@ -44,6 +71,7 @@ typedef struct entry_t {
     int offset1;
     int offset2;
     int offset3;
+    int delta;     /* delta of parse so far without end marker, only under delta constraint */
 } ENTRY;
 
 typedef struct cell_t {
@@ -52,15 +80,96 @@ typedef struct cell_t {
     ENTRY *table[HASH_SIZE];
 } CELL;
 
+typedef struct parse_t {
+    int *blocks;   /* pairs of offset and length, offset 0 for literals */
+    int count;
+    int capacity;
+    int offset1;
+    int offset2;
+    int offset3;
+} PARSE;
+
+/* cost tables, ready after prepare_costs() */
+extern unsigned char *elias_costs;
+extern unsigned char offset_costs[];
+
 
 BLOCK *allocate_block(int bits, int offset, int length, BLOCK *chain);
 
-void assign_block(BLOCK **ptr, BLOCK *chain);
+int collection_due();
+
+void begin_collection();
+
+void mark_blocks(BLOCK *chain);
+
+void keep_blocks(BLOCK *chain);
+
+void sweep_blocks();
 
 ENTRY *allocate_entry(int offset1, int offset2, int offset3);
 
 void free_list_entries(ENTRY *list);
 
-BLOCK *optimize(unsigned char *input_data, int input_size, int skip, int offset_limit);
+void reset_memory();
+
+void collect_after(long minimum);
+
+long allocated_blocks();
+
+long allocated_entries();
+
+int offset_ceiling(int index, int offset_limit);
+
+int hash(int offset1, int offset2, int offset3);
+
+long count_entries(CELL *cell);
+
+int elias_gamma_bits(int value);
+
+void prepare_costs(int input_size);
+
+BLOCK *upper_bound_block(unsigned char *input_data, int input_size, int skip, int offset_limit);
+
+int *lower_bounds(unsigned char *input_data, int input_size, int skip, int offset_limit);
+
+void use_snapshot(char *name);
+
+int resume_snapshot(unsigned char *input_data, int input_size, int skip, int offset_limit, CELL *optimal, CELL *last_literal, CELL *last_match);
+
+void save_snapshot(unsigned char *input_data, int index, int skip, int max_offset, CELL *optimal, CELL *last_literal, CELL *last_match);
+
+void finish_snapshot();
+
+void append_block(PARSE *parse, int offset, int length);
+
+int block_type(int offset, int *offset1, int *offset2, int *offset3);
+
+BLOCK *parse_optimal(PARSE *parse);
+
+long chain_bits(BLOCK *block);
+
+BLOCK **parse_blocks(BLOCK *optimal, int *count);
+
+void write_parse(char *name, BLOCK *optimal, int input_size, int skip, int backwards_mode);
+
+BLOCK *read_parse(char *name, unsigned char *input_data, int input_size, int skip, int offset_limit, int backwards_mode);
+
+void write_decoder(char *name, BLOCK *optimal, int backwards_mode, int fast_mode);
+
+BLOCK *optimize(unsigned char *input_data, int input_size, int skip, int offset_limit, int prune_mode, int progress_mode);
+
+BLOCK *optimize_delta(unsigned char *input_data, int input_size, int skip, int offset_limit, int max_delta, int lowest_delta, int *delta);
+
+int segment_processes(int processes, int segments);
+
+BLOCK *optimize_windowed(unsigned char *input_data, int input_size, int skip, int offset_limit, int prune_mode, int processes);
+
+void forecast(unsigned char *input_data, int input_size, int skip, int offset_limit, int prune_mode, int windowed_mode, int processes, char *mode_name);
 
 unsigned char *compress(BLOCK *optimal, unsigned char *input_data, int input_size, int skip, int backwards_mode, int invert_mode, int *output_size, int *delta);
+
+int transfer_data(int fd, void *data, int size, int writing);
+
+int open_server(char *name, int listening);
+
+unsigned char *compress_remote(char *server_name, unsigned char *input_data, int input_size, int skip, int flags, int *output_size, int *delta);
@@ -0,0 +1,234 @@
+/*
+ * ZX5 streaming decompressor - by Einar Saukas
+ * https://github.com/einar-saukas/ZX5
+ */
+
+#include <string.h>
+
+#include "zx5_stream.h"
+
+#define FALSE 0
+#define TRUE 1
+
+#define INITIAL_OFFSET 1
+
+#define WINDOW_MASK (ZX5_WINDOW_SIZE-1)
+
+/* decoding steps, where decoding resumes after running out of input or output */
+#define STEP_LITERALS_LENGTH        0
+#define STEP_LITERALS               1
+#define STEP_AFTER_LITERALS         2
+#define STEP_LAST_OFFSET_LENGTH     3
+#define STEP_OTHER_OFFSET           4
+#define STEP_PREVIOUS_OFFSET        5
+#define STEP_PREVIOUS_OFFSET_LENGTH 6
+#define STEP_NEW_OFFSET             7
+#define STEP_NEW_OFFSET_MSB         8
+#define STEP_NEW_OFFSET_LSB         9
+#define STEP_NEW_OFFSET_LENGTH      10
+#define STEP_COPY                   11
+#define STEP_AFTER_COPY             12
+#define STEP_END                    13
+#define STEP_ERROR                  14
+
+void zx5_stream_init(ZX5_STREAM *s, int classic_mode) {
+    s->classic_mode = classic_mode;
+    s->step = STEP_LITERALS_LENGTH;
+    s->bit_mask = 0;
+    s->backtrack = FALSE;
+    s->data_bit = FALSE;
+    s->value = 1;
+    s->last_offset1 = INITIAL_OFFSET;
+    s->last_offset2 = 0;
+    s->last_offset3 = 0;
+    s->position = 0;
+    s->input_used = 0;
+    s->output_used = 0;
+}
+
+/* next bit, or -1 if input is exhausted */
+static int stream_bit(ZX5_STREAM *s) {
+    if (s->backtrack) {
+        s->backtrack = FALSE;
+        return s->ahead_bit;
+    }
+    if (s->bit_mask <= 1) {
+        if (s->input_used == s->input_size)
+            return -1;
+        s->bit_mask = 128;
+        s->bit_value = s->input[s->input_used++];
+    } else {
+        s->bit_mask >>= 1;
+    }
+    return s->bit_value & s->bit_mask ? 1 : 0;
+}
+
+/* continue reading interlaced Elias Gamma value, returns FALSE if input is exhausted */
+static int stream_elias_gamma(ZX5_STREAM *s, int invert) {
+    int bit;
+
+    while ((bit = stream_bit(s)) >= 0) {
+        if (s->data_bit) {
+            s->value = s->value << 1 | (bit ^ invert);
+            s->data_bit = FALSE;
+        } else if (bit) {
+            return TRUE;
+        } else {
+            s->data_bit = TRUE;
+        }
+    }
+    return FALSE;
+}
+
+static void start_elias_gamma(ZX5_STREAM *s, int step) {
+    s->value = 1;
+    s->data_bit = FALSE;
+    s->step = step;
+}
+
+int zx5_stream_decode(ZX5_STREAM *s, unsigned char *in, size_t in_len, unsigned char *out, size_t out_cap) {
+    size_t n;
+    size_t i;
+    unsigned long from;
+    int offset;
+    int bit;
+
+    s->input = in;
+    s->input_size = in_len;
+    s->input_used = 0;
+    s->output = out;
+    s->output_size = out_cap;
+    s->output_used = 0;
+
+    for (;;) {
+        switch (s->step) {
+        case STEP_LITERALS_LENGTH:
+            if (!stream_elias_gamma(s, FALSE))
+                return ZX5_STREAM_INPUT;
+            s->length = s->value;
+            s->step = STEP_LITERALS;
+            /* fall through */
+        case STEP_LITERALS:
+            n = s->length;
+            if (n > s->input_size-s->input_used)
+                n = s->input_size-s->input_used;
+            if (n > s->output_size-s->output_used)
+                n = s->output_size-s->output_used;
+            memcpy(s->output+s->output_used, s->input+s->input_used, n);
+            for (i = 0; i < n; i++)
+                s->window[(s->position+i) & WINDOW_MASK] = s->input[s->input_used+i];
+            s->input_used += n;
+            s->output_used += n;
+            s->position += n;
+            s->length -= (int)n;
+            if (s->length)
+                return s->output_used == s->output_size ? ZX5_STREAM_OUTPUT : ZX5_STREAM_INPUT;
+            s->step = STEP_AFTER_LITERALS;
+            /* fall through */
+        case STEP_AFTER_LITERALS:
+            if ((bit = stream_bit(s)) < 0)
+                return ZX5_STREAM_INPUT;
+            if (bit) {
+                s->step = STEP_OTHER_OFFSET;
+                break;
+            }
+            start_elias_gamma(s, STEP_LAST_OFFSET_LENGTH);
+            /* fall through */
+        case STEP_LAST_OFFSET_LENGTH:
+            if (!stream_elias_gamma(s, FALSE))
+                return ZX5_STREAM_INPUT;
+            s->length = s->value;
+            s->step = STEP_COPY;
+            break;
+        case STEP_OTHER_OFFSET:
+            if ((bit = stream_bit(s)) < 0)
+                return ZX5_STREAM_INPUT;
+            s->step = bit ? STEP_NEW_OFFSET : STEP_PREVIOUS_OFFSET;
+            break;
+        case STEP_PREVIOUS_OFFSET:
+            if ((bit = stream_bit(s)) < 0)
+                return ZX5_STREAM_INPUT;
+            if (!bit) {
+                offset = s->last_offset2;
+            } else {
+                offset = s->last_offset3;
+                s->last_offset3 = s->last_offset2;
+            }
+            s->last_offset2 = s->last_offset1;
+            s->last_offset1 = offset;
+            start_elias_gamma(s, STEP_PREVIOUS_OFFSET_LENGTH);
+            /* fall through */
+        case STEP_PREVIOUS_OFFSET_LENGTH:
+            if (!stream_elias_gamma(s, FALSE))
+                return ZX5_STREAM_INPUT;
+            s->length = s->value;
+            s->step = STEP_COPY;
+            break;
+        case STEP_NEW_OFFSET:
+            if ((bit = stream_bit(s)) < 0)
+                return ZX5_STREAM_INPUT;
+            s->ahead_bit = bit;
+            start_elias_gamma(s, STEP_NEW_OFFSET_MSB);
+            /* fall through */
+        case STEP_NEW_OFFSET_MSB:
+            if (!stream_elias_gamma(s, !s->classic_mode))
+                return ZX5_STREAM_INPUT;
+            if (s->value == 256) {
+                s->step = STEP_END;
+                break;
+            }
+            if (s->value > 256) {
+                s->step = STEP_ERROR;
+                break;
+            }
+            s->step = STEP_NEW_OFFSET_LSB;
+            /* fall through */
+        case STEP_NEW_OFFSET_LSB:
+            if (s->input_used == s->input_size)
+                return ZX5_STREAM_INPUT;
+            s->last_offset3 = s->last_offset2;
+            s->last_offset2 = s->last_offset1;
+            s->last_offset1 = s->value*256-s->input[s->input_used++];
+            s->backtrack = TRUE;
+            start_elias_gamma(s, STEP_NEW_OFFSET_LENGTH);
+            /* fall through */
+        case STEP_NEW_OFFSET_LENGTH:
+            if (!stream_elias_gamma(s, FALSE))
+                return ZX5_STREAM_INPUT;
+            s->length = s->value+1;
+            s->step = STEP_COPY;
+            /* fall through */
+        case STEP_COPY:
+            /* offset must refer to data already produced and still in window */
+            if (s->last_offset1 <= 0 || s->last_offset1 > ZX5_WINDOW_SIZE || (unsigned long)s->last_offset1 > s->position) {
+                s->step = STEP_ERROR;
+                break;
+            }
+            n = s->length;
+            if (n > s->output_size-s->output_used)
+                n = s->output_size-s->output_used;
+            from = s->position-s->last_offset1;
+            for (i = 0; i < n; i++)
+                s->output[s->output_used+i] = s->window[(s->position+i) & WINDOW_MASK] = s->window[(from+i) & WINDOW_MASK];
+            s->output_used += n;
+            s->position += n;
+            s->length -= (int)n;
+            if (s->length)
+                return ZX5_STREAM_OUTPUT;
+            s->step = STEP_AFTER_COPY;
+            /* fall through */
+        case STEP_AFTER_COPY:
+            if ((bit = stream_bit(s)) < 0)
+                return ZX5_STREAM_INPUT;
+            if (bit)
+                s->step = STEP_OTHER_OFFSET;
+            else
+                start_elias_gamma(s, STEP_LITERALS_LENGTH);
+            break;
+        case STEP_END:
+            return ZX5_STREAM_END;
+        default:
+            return ZX5_STREAM_ERROR;
+        }
+    }
+}
@@ -0,0 +1,52 @@
+/*
+ * ZX5 streaming decompressor - by Einar Saukas
+ * https://github.com/einar-saukas/ZX5
+ */
+
+/*
+ * Resumable ZX5 decoder: call zx5_stream_decode() repeatedly with more input
+ * and/or output space, until it returns ZX5_STREAM_END or ZX5_STREAM_ERROR.
+ * After each call, fields input_used and output_used report how many bytes
+ * were consumed from input and produced into output.
+ */
+
+#ifndef ZX5_STREAM_H
+#define ZX5_STREAM_H
+
+#include <stddef.h>
+
+#define ZX5_WINDOW_SIZE 65536  /* must be power of 2 > MAX_OFFSET */
+
+#define ZX5_STREAM_ERROR  -1   /* invalid compressed data */
+#define ZX5_STREAM_INPUT   0   /* input consumed, more input required */
+#define ZX5_STREAM_OUTPUT  1   /* output full, more output space required */
+#define ZX5_STREAM_END     2   /* end marker reached */
+
+typedef struct zx5_stream_t {
+    int classic_mode;
+    int step;
+    int bit_mask;
+    int bit_value;
+    int backtrack;
+    int ahead_bit;
+    int data_bit;
+    int value;
+    int length;
+    int last_offset1;
+    int last_offset2;
+    int last_offset3;
+    unsigned char *input;
+    size_t input_size;
+    size_t input_used;
+    unsigned char *output;
+    size_t output_size;
+    size_t output_used;
+    unsigned long position;
+    unsigned char window[ZX5_WINDOW_SIZE];
+} ZX5_STREAM;
+
+void zx5_stream_init(ZX5_STREAM *s, int classic_mode);
+
+int zx5_stream_decode(ZX5_STREAM *s, unsigned char *in, size_t in_len, unsigned char *out, size_t out_cap);
+
+#endif
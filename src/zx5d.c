@@ -0,0 +1,292 @@
+/*
+ * (c) Copyright 2021 by Einar Saukas. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * The name of its author may not be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "zx5.h"
+
+#define MAX_PROCESSES 64
+
+char *cache_name = NULL;
+volatile sig_atomic_t stopping = FALSE;
+
+void stop(int signal_number) {
+    stopping = TRUE;
+}
+
+/* FNV-1a hash of request, used only to locate it in cache */
+unsigned long request_hash(unsigned char *input_data, int input_size, int skip, int flags) {
+    unsigned long hash = 2166136261UL;
+    int i;
+
+    hash = ((hash ^ flags) * 16777619UL) & 0xFFFFFFFFUL;
+    hash = ((hash ^ skip) * 16777619UL) & 0xFFFFFFFFUL;
+    for (i = 0; i < input_size; i++)
+        hash = ((hash ^ input_data[i]) * 16777619UL) & 0xFFFFFFFFUL;
+    return hash;
+}
+
+char *cache_file(unsigned long hash, char *suffix) {
+    char *name = (char *)malloc(strlen(cache_name)+32);
+
+    if (!name) {
+        fprintf(stderr, "Error: Insufficient memory\n");
+        exit(1);
+    }
+    sprintf(name, "%s/%08lx.zx5%s", cache_name, hash, suffix);
+    return name;
+}
+
+/* look for previous result of same request, storing entire input to rule out collisions */
+unsigned char *read_cache(unsigned char *input_data, int input_size, int skip, int flags, int *output_size, int *delta) {
+    FILE *fp;
+    char *name;
+    unsigned char *cached_data;
+    unsigned char *output_data = NULL;
+    int header[5];
+
+    name = cache_file(request_hash(input_data, input_size, skip, flags), "");
+    fp = fopen(name, "rb");
+    free(name);
+    if (!fp)
+        return NULL;
+    if (fread(header, sizeof(int), 5, fp) == 5 && header[0] == flags && header[1] == skip && header[2] == input_size &&
+        header[3] > 0 && header[3] <= MAX_INPUT_SIZE) {
+        cached_data = (unsigned char *)malloc(input_size);
+        output_data = (unsigned char *)malloc(header[3]);
+        if (!cached_data || !output_data) {
+            fprintf(stderr, "Error: Insufficient memory\n");
+            exit(1);
+        }
+        if (fread(cached_data, sizeof(char), input_size, fp) == (size_t)input_size && !memcmp(cached_data, input_data, input_size) &&
+            fread(output_data, sizeof(char), header[3], fp) == (size_t)header[3]) {
+            *output_size = header[3];
+            *delta = header[4];
+        } else {
+            free(output_data);
+            output_data = NULL;
+        }
+        free(cached_data);
+    }
+    fclose(fp);
+    return output_data;
+}
+
+void write_cache(unsigned char *input_data, int input_size, int skip, int flags, unsigned char *output_data, int output_size, int delta) {
+    FILE *fp;
+    unsigned long hash = request_hash(input_data, input_size, skip, flags);
+    char suffix[32];
+    char *name;
+    char *temporary_name;
+    int header[5];
+    int success;
+
+    /* write separately then rename, so other processes never see partial results */
+    sprintf(suffix, ".%ld", (long)getpid());
+    temporary_name = cache_file(hash, suffix);
+    fp = fopen(temporary_name, "wb");
+    if (fp) {
+        header[0] = flags;
+        header[1] = skip;
+        header[2] = input_size;
+        header[3] = output_size;
+        header[4] = delta;
+        success = fwrite(header, sizeof(int), 5, fp) == 5 &&
+                  fwrite(input_data, sizeof(char), input_size, fp) == (size_t)input_size &&
+                  fwrite(output_data, sizeof(char), output_size, fp) == (size_t)output_size;
+        if (!fclose(fp) && success) {
+            name = cache_file(hash, "");
+            rename(temporary_name, name);
+            free(name);
+        }
+        remove(temporary_name);
+    }
+    free(temporary_name);
+}
+
+void send_response(int fd, int status, void *data, int size, int delta) {
+    int response[3];
+
+    response[0] = status;
+    response[1] = size;
+    response[2] = delta;
+    if (transfer_data(fd, response, sizeof(response), TRUE))
+        transfer_data(fd, data, size, TRUE);
+}
+
+void send_error(int fd, char *message) {
+    send_response(fd, 1, message, strlen(message), 0);
+}
+
+void serve_request(int fd) {
+    BLOCK *optimal;
+    unsigned char *input_data;
+    unsigned char *output_data;
+    int request[4];
+    int output_size;
+    int delta;
+    int flags;
+    int skip;
+    int input_size;
+
+    if (!transfer_data(fd, request, sizeof(request), FALSE) || request[0] != SERVER_MAGIC) {
+        send_error(fd, "Invalid server request");
+        return;
+    }
+    flags = request[1];
+    skip = request[2];
+    input_size = request[3];
+    if (input_size <= 0 || input_size > MAX_INPUT_SIZE || skip < 0 || skip >= input_size) {
+        send_error(fd, "Invalid input size");
+        return;
+    }
+    input_data = (unsigned char *)malloc(input_size);
+    if (!input_data) {
+        send_error(fd, "Insufficient memory");
+        return;
+    }
+    if (!transfer_data(fd, input_data, input_size, FALSE)) {
+        free(input_data);
+        return;
+    }
+
+    /* input is already reversed by client in backwards mode */
+    output_data = cache_name ? read_cache(input_data, input_size, skip, flags, &output_size, &delta) : NULL;
+    if (!output_data) {
+        optimal = optimize(input_data, input_size, skip, flags & SERVER_QUICK ? MAX_OFFSET_ZX7 : MAX_OFFSET_ZX5, flags & SERVER_PRUNE, FALSE);
+        output_data = compress(optimal, input_data, input_size, skip, flags & SERVER_BACKWARDS, !(flags & SERVER_CLASSIC) && !(flags & SERVER_BACKWARDS), &output_size, &delta);
+
+        /* release all blocks and entries at once, keeping memory regions for next request */
+        reset_memory();
+
+        if (cache_name)
+            write_cache(input_data, input_size, skip, flags, output_data, output_size, delta);
+    }
+    send_response(fd, 0, output_data, output_size, delta);
+
+    free(input_data);
+    free(output_data);
+}
+
+pid_t start_worker(int server_fd) {
+    pid_t pid;
+    int fd;
+
+    pid = fork();
+    if (pid)
+        return pid;
+
+    /* each worker handles one request at a time, until stopped */
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    signal(SIGPIPE, SIG_IGN);
+    for (;;) {
+        fd = accept(server_fd, NULL, NULL);
+        if (fd >= 0) {
+            serve_request(fd);
+            close(fd);
+        }
+    }
+}
+
+int main(int argc, char *argv[]) {
+    struct sigaction action;
+    pid_t pids[MAX_PROCESSES];
+    pid_t pid;
+    char *server_name;
+    int processes = 0;
+    int server_fd;
+    int i;
+
+    printf("ZX5d v2.0: Experimental compression daemon by Einar Saukas\n");
+
+    /* process optional parameters */
+    for (i = 1; i < argc && *argv[i] == '-'; i++) {
+        if (!strncmp(argv[i], "-j", 2) && (processes = atoi(argv[i]+2)) > 0) {
+            ;
+        } else if (!strcmp(argv[i], "--cache") && i+1 < argc) {
+            cache_name = argv[++i];
+        } else {
+            fprintf(stderr, "Error: Invalid parameter %s\n", argv[i]);
+            exit(1);
+        }
+    }
+
+    if (argc != i+1) {
+        fprintf(stderr, "Usage: %s [-jN] [--cache DIR] socket\n"
+                        "  -jN          Use N worker processes\n"
+                        "  --cache DIR  Keep compressed results in directory\n", argv[0]);
+        exit(1);
+    }
+
+    if (processes <= 0)
+        processes = sysconf(_SC_NPROCESSORS_ONLN);
+    if (processes <= 0)
+        processes = 1;
+    if (processes > MAX_PROCESSES)
+        processes = MAX_PROCESSES;
+
+    server_name = argv[i];
+    server_fd = open_server(server_name, TRUE);
+    if (server_fd < 0) {
+        fprintf(stderr, "Error: Cannot create server %s\n", server_name);
+        exit(1);
+    }
+
+    /* stop waiting for workers when interrupted */
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = stop;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    printf("Listening on %s with %d workers\n", server_name, processes);
+    fflush(stdout);
+
+    for (i = 0; i < processes; i++)
+        pids[i] = start_worker(server_fd);
+
+    /* replace workers that failed (for instance, out of memory) */
+    while (!stopping) {
+        pid = wait(NULL);
+        for (i = 0; i < processes && !stopping; i++)
+            if (pids[i] == pid)
+                pids[i] = start_worker(server_fd);
+    }
+
+    for (i = 0; i < processes; i++)
+        if (pids[i] > 0)
+            kill(pids[i], SIGTERM);
+    while (wait(NULL) > 0)
+        ;
+    unlink(server_name);
+    return 0;
+}
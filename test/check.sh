@@ -0,0 +1,111 @@
+#!/bin/sh
+#
+# ZX5 regression tests: compresses generated inputs in problematic cases,
+# then checks that decompressing each result reproduces the original.
+#
+# Usage: check.sh zx5 dzx5 z80run work_dir
+#
+
+ZX5=$1
+DZX5=$2
+Z80RUN=$3
+WORK=$4
+Z80=`dirname "$0"`/../z80
+
+mkdir -p "$WORK" || exit 1
+
+passed=0
+failed=0
+
+# pseudo-random bytes: generate size seed [values]
+generate() {
+    LC_ALL=C awk -v size="$1" -v seed="$2" -v values="${3:-256}" 'BEGIN { srand(seed); for (i = 0; i < size; i++) printf "%c", int(rand()*values) }'
+}
+
+# input repeated up to size: repeat name size
+repeat() {
+    : > "$WORK/$1.tmp"
+    while [ `wc -c < "$WORK/$1.tmp"` -lt "$2" ]; do
+        cat "$WORK/$1" >> "$WORK/$1.tmp"
+    done
+    head -c "$2" "$WORK/$1.tmp"
+    rm -f "$WORK/$1.tmp"
+}
+
+report() {
+    if [ $1 -eq 0 ]; then
+        passed=$((passed+1))
+    else
+        echo "FAILED: $2"
+        failed=$((failed+1))
+    fi
+}
+
+# compress and decompress: check name [options...]
+check() {
+    name=$1
+    shift
+    "$ZX5" -f "$@" "$WORK/$name" "$WORK/$name.zx5" > /dev/null &&
+    "$DZX5" -f "$WORK/$name.zx5" "$WORK/$name.out" > /dev/null &&
+    cmp -s "$WORK/$name" "$WORK/$name.out"
+    report $? "zx5 $* $name"
+}
+
+# compress with generated decoder, that must decompress it within standard size
+# (unless unrolled) saving exactly predicted T-states: check_decoder name option [-b]
+check_decoder() {
+    name=$1
+    standard=dzx5_standard.asm
+    [ -n "$3" ] && standard=dzx5_standard_back.asm
+    "$ZX5" -f $3 $2 "$WORK/$name.asm" "$WORK/$name" "$WORK/$name.zx5" > "$WORK/$name.log" &&
+    sizes=`sed -n 's/.* with \([0-9]*\) bytes (standard \([0-9]*\) bytes).*/\1 \2/p' "$WORK/$name.log"` &&
+    savings=`sed -n 's/.*saving \([0-9]*\) T-states.*/\1/p' "$WORK/$name.log"` &&
+    standard_time=`"$Z80RUN" $3 "$Z80/$standard" "$WORK/$name.zx5" "$WORK/$name"` &&
+    custom_time=`"$Z80RUN" $3 "$WORK/$name.asm" "$WORK/$name.zx5" "$WORK/$name"` &&
+    [ $((standard_time-custom_time)) -eq "$savings" ] &&
+    { [ "$2" != --emit-decoder ] || [ ${sizes% *} -le ${sizes#* } ]; }
+    report $? "zx5 $3 $2 $name"
+}
+
+# windowed segments where repetitions cross segment boundaries
+generate 1500 7 > "$WORK/period"
+repeat period 52400 > "$WORK/windowed"
+check windowed -q -w
+
+# resuming from snapshot after editing near the end must match compressing from scratch
+repeat period 9000 > "$WORK/resumed"
+rm -f "$WORK/resumed.snap"
+"$ZX5" -f -q --snapshot "$WORK/resumed.snap" "$WORK/resumed" "$WORK/resumed.zx5" > /dev/null &&
+(head -c 8500 "$WORK/resumed"; printf 'edited'; tail -c 494 "$WORK/resumed") > "$WORK/edited" &&
+"$ZX5" -f -q --snapshot "$WORK/resumed.snap" "$WORK/edited" "$WORK/resumed.zx5" > /dev/null &&
+"$ZX5" -f -q "$WORK/edited" "$WORK/edited.zx5" > /dev/null &&
+cmp -s "$WORK/resumed.zx5" "$WORK/edited.zx5" &&
+[ `wc -c < "$WORK/resumed.snap"` -le $((9000*20)) ]
+report $? "zx5 -q --snapshot after edit"
+
+# parse starting with a copy must be rejected, since the first indicator bit is never written
+printf 'abcdefghijklmnopqrstuvwxyz%.0s' 1 2 3 4 > "$WORK/prefixed"
+printf 'ZX5 parse 104 26 forward\nnew 26 78\n' > "$WORK/prefixed.parse"
+! "$ZX5" -f +26 --from-parse "$WORK/prefixed.parse" "$WORK/prefixed" "$WORK/prefixed.zx5" > /dev/null 2>&1
+report $? "zx5 +26 --from-parse starting with copy"
+
+# generated decoders, either removing long offsets and previous offsets or unrolling common paths
+generate 200 5 > "$WORK/short"
+repeat short 1000 > "$WORK/short_offsets"
+check_decoder short_offsets --emit-decoder
+check_decoder short_offsets --emit-decoder -b
+generate 600 3 32 > "$WORK/mixed"
+check_decoder mixed --emit-decoder
+check_decoder mixed --emit-fast-decoder
+check_decoder mixed --emit-fast-decoder -b
+
+# delta limit below regular compression, reached by trading size for delta
+(repeat short 1000; generate 100 9 16) > "$WORK/limited"
+"$ZX5" -f --max-delta 2 "$WORK/limited" "$WORK/limited.zx5" > "$WORK/limited.log" &&
+grep -q '(delta 2)' "$WORK/limited.log" &&
+"$DZX5" -f "$WORK/limited.zx5" "$WORK/limited.out" > /dev/null &&
+cmp -s "$WORK/limited" "$WORK/limited.out"
+report $? "zx5 --max-delta 2 limited"
+
+echo "$passed passed, $failed failed"
+[ $failed -eq 0 ]
@@ -0,0 +1,382 @@
+/*
+ * (c) Copyright 2021 by Einar Saukas. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * The name of its author may not be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Minimal Z80 interpreter for ZX5 decoder routines: runs assembly source
+ * directly, supporting only instructions used by these routines, then
+ * reports T-states spent decompressing.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#define FALSE 0
+#define TRUE 1
+
+#define MAX_LINES 512
+#define MAX_LABELS 128
+#define MAX_STEPS 100000000L
+
+#define STACK_TOP 0xFF00
+#define RETURN_MARKER 0xFFFF
+#define FIRST_ADDRESS 0x0100
+
+typedef struct instruction_t {
+    char op[8];
+    char arg1[32];
+    char arg2[32];
+} INSTRUCTION;
+
+typedef struct label_t {
+    char name[32];
+    int index;
+} LABEL;
+
+INSTRUCTION program[MAX_LINES];
+int program_size = 0;
+LABEL labels[MAX_LABELS];
+int label_count = 0;
+
+/* registers B, C, D, E, H, L, A in same order as pairs, alternate ones without A */
+char *register_names = "bcdehla";
+unsigned char regs[7];
+unsigned char alt_regs[6];
+int carry_flag = FALSE;
+int zero_flag = FALSE;
+int sign_flag = FALSE;
+unsigned sp = STACK_TOP;
+unsigned char memory[65536];
+long tstates = 0;
+
+void invalid_line(char *text) {
+    fprintf(stderr, "Error: Unsupported line %s\n", text);
+    exit(1);
+}
+
+void load_program(char *name) {
+    FILE *fp;
+    char line[256];
+    char *text;
+    char *next;
+    INSTRUCTION *instruction;
+
+    fp = fopen(name, "r");
+    if (!fp) {
+        fprintf(stderr, "Error: Cannot access decoder file %s\n", name);
+        exit(1);
+    }
+    while (fgets(line, sizeof(line), fp)) {
+        if ((next = strchr(line, ';')) != NULL)
+            *next = 0;
+        for (next = line+strlen(line); next > line && isspace((unsigned char)next[-1]); )
+            *--next = 0;
+        if (!*line)
+            continue;
+
+        /* labels start at first column */
+        if (!isspace((unsigned char)*line)) {
+            if (!(next = strchr(line, ':')) || next[1] || next-line >= 32 || label_count == MAX_LABELS)
+                invalid_line(line);
+            *next = 0;
+            strcpy(labels[label_count].name, line);
+            labels[label_count++].index = program_size;
+            continue;
+        }
+
+        if (program_size == MAX_LINES)
+            invalid_line(line);
+        instruction = &program[program_size++];
+        *instruction->arg1 = *instruction->arg2 = 0;
+        for (text = line; isspace((unsigned char)*text); text++)
+            ;
+        if (sscanf(text, "%7s %31[^, ] , %31s", instruction->op, instruction->arg1, instruction->arg2) < 1)
+            invalid_line(line);
+    }
+    fclose(fp);
+}
+
+int find_label(char *name) {
+    int i;
+
+    for (i = 0; i < label_count; i++)
+        if (!strcmp(labels[i].name, name))
+            return labels[i].index;
+    fprintf(stderr, "Error: Undefined label %s\n", name);
+    exit(1);
+}
+
+/* register index, or -1 if not a single register */
+int reg(char *name) {
+    char *found = strchr(register_names, *name);
+
+    return *name && !name[1] && found ? (int)(found-register_names) : -1;
+}
+
+/* pair index as its high register, or -1 if not a register pair */
+int pair(char *name) {
+    return !strcmp(name, "bc") ? 0 : !strcmp(name, "de") ? 2 : !strcmp(name, "hl") ? 4 : -1;
+}
+
+unsigned get_pair(int index) {
+    return regs[index] << 8 | regs[index+1];
+}
+
+void set_pair(int index, unsigned value) {
+    regs[index] = (value >> 8) & 0xFF;
+    regs[index+1] = value & 0xFF;
+}
+
+unsigned number(char *text) {
+    return (unsigned)strtol(*text == '$' ? text+1 : text, NULL, *text == '$' ? 16 : 10);
+}
+
+void push(unsigned value) {
+    sp = (sp-2) & 0xFFFF;
+    memory[sp] = value & 0xFF;
+    memory[(sp+1) & 0xFFFF] = (value >> 8) & 0xFF;
+}
+
+unsigned pop() {
+    unsigned value = memory[sp] | memory[(sp+1) & 0xFFFF] << 8;
+
+    sp = (sp+2) & 0xFFFF;
+    return value;
+}
+
+void set_result(int value) {
+    zero_flag = !(value & 0xFF);
+    sign_flag = (value & 0x80) != 0;
+}
+
+int condition(char *name) {
+    if (!strcmp(name, "c"))
+        return carry_flag;
+    if (!strcmp(name, "nc"))
+        return !carry_flag;
+    if (!strcmp(name, "z"))
+        return zero_flag;
+    if (!strcmp(name, "nz"))
+        return !zero_flag;
+    if (!strcmp(name, "p"))
+        return !sign_flag;
+    if (!strcmp(name, "m"))
+        return sign_flag;
+    fprintf(stderr, "Error: Unsupported condition %s\n", name);
+    exit(1);
+}
+
+void run(int pc) {
+    INSTRUCTION *instruction;
+    unsigned value;
+    long steps;
+    int dest;
+    int step;
+    int i;
+
+    push(RETURN_MARKER);
+    for (steps = 0; steps < MAX_STEPS; steps++) {
+        if (pc < 0 || pc >= program_size) {
+            fprintf(stderr, "Error: Execution left decoder routine\n");
+            exit(1);
+        }
+        instruction = &program[pc++];
+        if (!strcmp(instruction->op, "ld")) {
+            if ((dest = pair(instruction->arg1)) >= 0) {
+                set_pair(dest, number(instruction->arg2));
+                tstates += 10;
+            } else if ((dest = reg(instruction->arg1)) < 0) {
+                invalid_line(instruction->op);
+            } else if (!strcmp(instruction->arg2, "(hl)")) {
+                regs[dest] = memory[get_pair(4)];
+                tstates += 7;
+            } else if (reg(instruction->arg2) >= 0) {
+                regs[dest] = regs[reg(instruction->arg2)];
+                tstates += 4;
+            } else {
+                regs[dest] = number(instruction->arg2) & 0xFF;
+                tstates += 7;
+            }
+        } else if (!strcmp(instruction->op, "push")) {
+            push(get_pair(pair(instruction->arg1)));
+            tstates += 11;
+        } else if (!strcmp(instruction->op, "pop")) {
+            set_pair(pair(instruction->arg1), pop());
+            tstates += 10;
+        } else if (!strcmp(instruction->op, "inc") || !strcmp(instruction->op, "dec")) {
+            step = !strcmp(instruction->op, "inc") ? 1 : -1;
+            if ((dest = pair(instruction->arg1)) >= 0) {
+                set_pair(dest, (get_pair(dest)+step) & 0xFFFF);
+                tstates += 6;
+            } else if ((dest = reg(instruction->arg1)) >= 0) {
+                regs[dest] = (regs[dest]+step) & 0xFF;
+                set_result(regs[dest]);
+                tstates += 4;
+            } else {
+                invalid_line(instruction->op);
+            }
+        } else if (!strcmp(instruction->op, "add")) {
+            if (!strcmp(instruction->arg1, "a") && !strcmp(instruction->arg2, "a")) {
+                carry_flag = (regs[6] & 0x80) != 0;
+                regs[6] = (regs[6] << 1) & 0xFF;
+                set_result(regs[6]);
+                tstates += 4;
+            } else if (!strcmp(instruction->arg1, "hl") && !strcmp(instruction->arg2, "de")) {
+                value = get_pair(4)+get_pair(2);
+                carry_flag = value > 0xFFFF;
+                set_pair(4, value & 0xFFFF);
+                tstates += 11;
+            } else {
+                invalid_line(instruction->op);
+            }
+        } else if (!strcmp(instruction->op, "rla") || !strcmp(instruction->op, "rl")) {
+            dest = !strcmp(instruction->op, "rla") ? 6 : reg(instruction->arg1);
+            if (dest < 0)
+                invalid_line(instruction->op);
+            value = regs[dest] << 1 | carry_flag;
+            carry_flag = value > 0xFF;
+            regs[dest] = value & 0xFF;
+            if (!strcmp(instruction->op, "rl")) {
+                set_result(regs[dest]);
+                tstates += 8;
+            } else {
+                tstates += 4;
+            }
+        } else if (!strcmp(instruction->op, "ldir") || !strcmp(instruction->op, "lddr")) {
+            step = !strcmp(instruction->op, "ldir") ? 1 : -1;
+            do {
+                memory[get_pair(2)] = memory[get_pair(4)];
+                set_pair(4, (get_pair(4)+step) & 0xFFFF);
+                set_pair(2, (get_pair(2)+step) & 0xFFFF);
+                set_pair(0, (get_pair(0)-1) & 0xFFFF);
+                tstates += get_pair(0) ? 21 : 16;
+            } while (get_pair(0));
+        } else if (!strcmp(instruction->op, "ex")) {
+            if (!strcmp(instruction->arg1, "(sp)")) {
+                value = pop();
+                push(get_pair(4));
+                set_pair(4, value);
+                tstates += 19;
+            } else {
+                value = get_pair(2);
+                set_pair(2, get_pair(4));
+                set_pair(4, value);
+                tstates += 4;
+            }
+        } else if (!strcmp(instruction->op, "exx")) {
+            for (i = 0; i < 6; i++) {
+                value = regs[i];
+                regs[i] = alt_regs[i];
+                alt_regs[i] = value;
+            }
+            tstates += 4;
+        } else if (!strcmp(instruction->op, "jr") || !strcmp(instruction->op, "jp")) {
+            if (!*instruction->arg2 || condition(instruction->arg1)) {
+                pc = find_label(*instruction->arg2 ? instruction->arg2 : instruction->arg1);
+                tstates += strcmp(instruction->op, "jp") ? 12 : 10;
+            } else {
+                tstates += strcmp(instruction->op, "jp") ? 7 : 10;
+            }
+        } else if (!strcmp(instruction->op, "call")) {
+            if (!*instruction->arg2 || condition(instruction->arg1)) {
+                push(pc);
+                pc = find_label(*instruction->arg2 ? instruction->arg2 : instruction->arg1);
+                tstates += 17;
+            } else {
+                tstates += 10;
+            }
+        } else if (!strcmp(instruction->op, "ret")) {
+            if (!*instruction->arg1 || condition(instruction->arg1)) {
+                tstates += *instruction->arg1 ? 11 : 10;
+                if ((pc = pop()) == RETURN_MARKER)
+                    return;
+            } else {
+                tstates += 5;
+            }
+        } else {
+            invalid_line(instruction->op);
+        }
+    }
+    fprintf(stderr, "Error: Decoder routine never finished\n");
+    exit(1);
+}
+
+unsigned char *read_file(char *name, int *size) {
+    FILE *fp;
+    unsigned char *data;
+
+    fp = fopen(name, "rb");
+    if (!fp) {
+        fprintf(stderr, "Error: Cannot access file %s\n", name);
+        exit(1);
+    }
+    data = (unsigned char *)malloc(65536);
+    if (!data) {
+        fprintf(stderr, "Error: Insufficient memory\n");
+        exit(1);
+    }
+    *size = fread(data, sizeof(char), 65536, fp);
+    fclose(fp);
+    return data;
+}
+
+int main(int argc, char *argv[]) {
+    unsigned char *input_data;
+    unsigned char *expected_data;
+    int backwards_mode;
+    int input_size;
+    int expected_size;
+    int first;
+    int last;
+
+    backwards_mode = argc == 5 && !strcmp(argv[1], "-b");
+    if (argc != 4+backwards_mode) {
+        fprintf(stderr, "Usage: %s [-b] decoder.asm input.zx5 expected\n", argv[0]);
+        exit(1);
+    }
+    load_program(argv[1+backwards_mode]);
+    input_data = read_file(argv[2+backwards_mode], &input_size);
+    expected_data = read_file(argv[3+backwards_mode], &expected_size);
+    if (!program_size || FIRST_ADDRESS+expected_size+input_size > STACK_TOP-256) {
+        fprintf(stderr, "Error: Cannot fit decoder test in memory\n");
+        exit(1);
+    }
+
+    /* decompress from top of memory into bottom, either forward or backwards */
+    first = STACK_TOP-256-input_size;
+    memcpy(memory+first, input_data, input_size);
+    set_pair(4, backwards_mode ? first+input_size-1 : first);
+    set_pair(2, backwards_mode ? FIRST_ADDRESS+expected_size-1 : FIRST_ADDRESS);
+    run(0);
+
+    last = backwards_mode ? FIRST_ADDRESS-1 : FIRST_ADDRESS+expected_size;
+    if ((int)get_pair(2) != last || memcmp(memory+FIRST_ADDRESS, expected_data, expected_size)) {
+        fprintf(stderr, "Error: Decoder %s did not reproduce %s\n", argv[1+backwards_mode], argv[3+backwards_mode]);
+        exit(1);
+    }
+    printf("%ld\n", tstates);
+    return 0;
+}